@@ -0,0 +1,84 @@
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+#include <string>
+
+#include "settings.h"
+
+namespace {
+
+// `sections` sections of `keys` keys, values as found in most files.
+std::string PlainFile(int sections, int keys) {
+  std::string content = "; generated\n";
+  for (int s = 0; s < sections; ++s) {
+    content += "[section" + std::to_string(s) + "]\n";
+    for (int k = 0; k < keys; ++k) {
+      content += "key" + std::to_string(k) + " = value" + std::to_string(k) +
+                 "  ; comment\n";
+    }
+  }
+  return content;
+}
+
+// the same file with quoted values.
+std::string QuotedFile(int sections, int keys) {
+  std::string content;
+  for (int s = 0; s < sections; ++s) {
+    content += "[section" + std::to_string(s) + "]\n";
+    for (int k = 0; k < keys; ++k) {
+      content += "key" + std::to_string(k) + " = \"https://host/path#" +
+                 std::to_string(k) + "\"\n";
+    }
+  }
+  return content;
+}
+
+// the same file with accented values, as written by a French operator.
+std::string Utf8File(int sections, int keys) {
+  std::string content = "\xEF\xBB\xBF";
+  for (int s = 0; s < sections; ++s) {
+    content += "[section" + std::to_string(s) + "]\n";
+    for (int k = 0; k < keys; ++k) {
+      content += "key" + std::to_string(k) + " = r\xC3\xA9seau " +
+                 std::to_string(k) + "\n";
+    }
+  }
+  return content;
+}
+
+void BM_ReadIni(benchmark::State& state, const std::string& content) {
+  for (auto _ : state) {
+    std::istringstream stream(content);
+    StrStrMap tbl;
+    ReadIni(stream, tbl);
+    benchmark::DoNotOptimize(tbl);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+// with the diagnostics, and the UTF-8 check when `validate_utf8` is set.
+void BM_ReadIniDiagnostics(benchmark::State& state, const std::string& content,
+                           bool validate_utf8) {
+  for (auto _ : state) {
+    std::istringstream stream(content);
+    StrStrMap tbl;
+    IniDiagnostics diagnostics;
+    ReadIni(stream, tbl,
+            {nullptr, nullptr, nullptr, nullptr, &diagnostics, nullptr,
+             validate_utf8});
+    benchmark::DoNotOptimize(tbl);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+}
+
+BENCHMARK_CAPTURE(BM_ReadIni, plain, PlainFile(100, 100));
+BENCHMARK_CAPTURE(BM_ReadIni, quoted, QuotedFile(100, 100));
+BENCHMARK_CAPTURE(BM_ReadIni, utf8, Utf8File(100, 100));
+BENCHMARK_CAPTURE(BM_ReadIniDiagnostics, plain, PlainFile(100, 100), false);
+BENCHMARK_CAPTURE(BM_ReadIniDiagnostics, plain_validate_utf8,
+                  PlainFile(100, 100), true);
+BENCHMARK_CAPTURE(BM_ReadIniDiagnostics, utf8, Utf8File(100, 100), false);
+BENCHMARK_CAPTURE(BM_ReadIniDiagnostics, utf8_validate_utf8,
+                  Utf8File(100, 100), true);
+
+}  // namespace
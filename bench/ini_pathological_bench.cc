@@ -0,0 +1,123 @@
+#include <benchmark/benchmark.h>
+
+#include <sstream>
+#include <string>
+
+#include "settings.h"
+
+namespace {
+
+// inputs crafted against the parser, of about `n` bytes each.
+std::string LongLine(int n) { return "[a]\nk = " + std::string(n, 'x') + "\n"; }
+std::string LongHeader(int n) { return std::string(n, '[') + "\n"; }
+std::string LongQuotes(int n) {
+  return "[a]\nk = " + std::string(n, '"') + "\n";
+}
+std::string LongEscapes(int n) {
+  return "[a]\nk = \"" + std::string(n, '\\') + "\n";
+}
+std::string LongDottedKey(int n) {
+  std::string key;
+  for (int i = 0; i < n / 2; ++i) {
+    key += "a.";
+  }
+  return "[" + key + "]\n" + key + "= 1\n";
+}
+std::string ManyContinuations(int n) {
+  std::string content = "[a]\nk = x \\\n";
+  for (int i = 0; i < n / 4; ++i) {
+    content += "x \\\n";
+  }
+  return content + "x\n";
+}
+// a continuation line of backslashes then spaces: only the last `\`, spaces
+// aside, continues the value, wherever the others are.
+std::string ManyBackslashes(int n) {
+  std::string content = "[a]\nk = a \\\n";
+  for (int i = 0; i < n / 4; ++i) {
+    content += "\\x";
+  }
+  return content + std::string(n / 2, ' ') + "\n";
+}
+std::string ManyDuplicateKeys(int n) {
+  std::string content = "[a]\n";
+  for (int i = 0; i < n / 6; ++i) {
+    content += "k = v\n";
+  }
+  return content;
+}
+std::string ManySections(int n) {
+  std::string content;
+  for (int i = 0; static_cast<int>(content.size()) < n; ++i) {
+    content += "[s" + std::to_string(i) + "]\n";
+  }
+  return content;
+}
+std::string ManyEmptyKeys(int n) {
+  std::string content = "[a]\n";
+  for (int i = 0; i < n / 2; ++i) {
+    content += "=\n";
+  }
+  return content;
+}
+
+// parsed with the diagnostics on, the parse time must stay linear in `n`.
+void BM_ReadPathological(benchmark::State& state,
+                         std::string (*generate)(int)) {
+  std::string content = generate(static_cast<int>(state.range(0)));
+  // rewound rather than copied at each iteration.
+  std::istringstream stream(content);
+  for (auto _ : state) {
+    stream.clear();
+    stream.seekg(0);
+    StrStrMap tbl;
+    IniDiagnostics diagnostics;
+    ReadIni(stream, tbl,
+            {nullptr, nullptr, nullptr, nullptr, &diagnostics, nullptr,
+             true});
+    benchmark::DoNotOptimize(tbl);
+  }
+  state.SetBytesProcessed(state.iterations() * content.size());
+  state.SetComplexityN(state.range(0));
+}
+
+// a bounded parse stops early whatever the size of the input.
+void BM_ReadPathologicalBounded(benchmark::State& state,
+                                std::string (*generate)(int)) {
+  std::string content = generate(static_cast<int>(state.range(0)));
+  IniLimits limits{4096, 10000, 4096, 1 << 16};
+  std::istringstream stream(content);
+  for (auto _ : state) {
+    stream.clear();
+    stream.seekg(0);
+    StrStrMap tbl;
+    ReadIni(stream, tbl,
+            {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, false,
+             &limits});
+    benchmark::DoNotOptimize(tbl);
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+#define INI_PATHOLOGICAL_BENCHMARK(generate)                             \
+  BENCHMARK_CAPTURE(BM_ReadPathological, generate, generate)             \
+      ->RangeMultiplier(4)                                               \
+      ->Range(1 << 10, 1 << 20)                                          \
+      ->Complexity(benchmark::oN);                                       \
+  BENCHMARK_CAPTURE(BM_ReadPathologicalBounded, generate, generate)      \
+      ->RangeMultiplier(16)                                              \
+      ->Range(1 << 12, 1 << 24)                                          \
+      ->Complexity(benchmark::o1)
+
+INI_PATHOLOGICAL_BENCHMARK(LongLine);
+INI_PATHOLOGICAL_BENCHMARK(LongHeader);
+INI_PATHOLOGICAL_BENCHMARK(LongQuotes);
+INI_PATHOLOGICAL_BENCHMARK(LongEscapes);
+INI_PATHOLOGICAL_BENCHMARK(LongDottedKey);
+INI_PATHOLOGICAL_BENCHMARK(ManyContinuations);
+INI_PATHOLOGICAL_BENCHMARK(ManyBackslashes);
+INI_PATHOLOGICAL_BENCHMARK(ManyDuplicateKeys);
+INI_PATHOLOGICAL_BENCHMARK(ManySections);
+INI_PATHOLOGICAL_BENCHMARK(ManyEmptyKeys);
+
+}  // namespace
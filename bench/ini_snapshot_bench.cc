@@ -0,0 +1,106 @@
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "settings.h"
+
+namespace {
+
+// `keys` keys, as in a large generated file.
+StrStrMap LargeTbl(int keys) {
+  StrStrMap tbl;
+  for (int k = 0; k < keys; ++k) {
+    tbl.emplace(SharedStr("section" + std::to_string(k % 100) + ".key" +
+                          std::to_string(k)),
+                SharedStr("value" + std::to_string(k)));
+  }
+  return tbl;
+}
+
+// one write published as a new version of the persistent table.
+void BM_SnapshotSet(benchmark::State& state) {
+  IniPersistentMap map(LargeTbl(static_cast<int>(state.range(0))));
+  SharedStr key("section7.key7");
+  SharedStr values[] = {SharedStr("1"), SharedStr("2")};
+  int i = 0;
+  for (auto _ : state) {
+    auto next = map.Set(key, values[++i & 1]);
+    benchmark::DoNotOptimize(next);
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// the same write when publishing copies the whole table.
+void BM_CopySet(benchmark::State& state) {
+  StrStrMap tbl = LargeTbl(static_cast<int>(state.range(0)));
+  SharedStr key("section7.key7");
+  SharedStr values[] = {SharedStr("1"), SharedStr("2")};
+  int i = 0;
+  for (auto _ : state) {
+    StrStrMap next = tbl;
+    next.insert_or_assign(key, values[++i & 1]);
+    benchmark::DoNotOptimize(next);
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// a reload that changed one key, published as a new version.
+void BM_SnapshotUpdate(benchmark::State& state) {
+  StrStrMap tbl = LargeTbl(static_cast<int>(state.range(0)));
+  IniPersistentMap map(tbl);
+  tbl.insert_or_assign(SharedStr("section7.key7"), SharedStr("changed"));
+  for (auto _ : state) {
+    auto next = map.Update(tbl);
+    benchmark::DoNotOptimize(next);
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// the same reload building a new tree.
+void BM_SnapshotBuild(benchmark::State& state) {
+  StrStrMap tbl = LargeTbl(static_cast<int>(state.range(0)));
+  for (auto _ : state) {
+    IniPersistentMap next(tbl);
+    benchmark::DoNotOptimize(next);
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+// the changes of a write, `shared` when the versions share their nodes.
+void BM_SnapshotDiff(benchmark::State& state, bool shared) {
+  StrStrMap tbl = LargeTbl(static_cast<int>(state.range(0)));
+  IniPersistentMap from(tbl);
+  IniPersistentMap to = shared ? from : IniPersistentMap(tbl);
+  to = to.Set(SharedStr("section7.key7"), SharedStr("changed"));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Diff(from, to));
+  }
+  state.SetComplexityN(state.range(0));
+}
+
+BENCHMARK(BM_SnapshotSet)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 20)
+    ->Complexity(benchmark::oLogN);
+BENCHMARK(BM_CopySet)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 16)
+    ->Complexity(benchmark::oN);
+BENCHMARK(BM_SnapshotUpdate)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 20)
+    ->Complexity(benchmark::oN);
+BENCHMARK(BM_SnapshotBuild)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 20)
+    ->Complexity(benchmark::oN);
+BENCHMARK_CAPTURE(BM_SnapshotDiff, shared, true)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 20)
+    ->Complexity(benchmark::oLogN);
+BENCHMARK_CAPTURE(BM_SnapshotDiff, unshared, false)
+    ->RangeMultiplier(16)
+    ->Range(1 << 8, 1 << 20)
+    ->Complexity(benchmark::oN);
+
+}  // namespace
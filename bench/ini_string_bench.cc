@@ -0,0 +1,70 @@
+#include <benchmark/benchmark.h>
+
+#include <locale>
+#include <string>
+
+#include "settings.h"
+
+namespace {
+
+// a key as written in most files.
+std::string TypicalInput() { return "  max_connections "; }
+// a value padded by an editor.
+std::string WhitespaceHeavyInput() {
+  return std::string(64, ' ') + "\t value \t" + std::string(64, ' ') + "\r";
+}
+
+void BM_Trim(benchmark::State& state, const std::string& input) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Trim(input));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void BM_TrimLocale(benchmark::State& state, const std::string& input) {
+  std::locale loc;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Trim(input, loc));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+// a combined key as split by `WriteIni`.
+std::string ShortKeyInput() { return "server.max_connections"; }
+// a list value as split by `GetList`.
+std::string LongListInput() {
+  std::string list;
+  for (int i = 0; i < 1000; ++i) {
+    list += "host-" + std::to_string(i) + ":8080, ";
+  }
+  return list;
+}
+
+void BM_Split(benchmark::State& state, const std::string& input,
+              const std::string& separators) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Split(input, separators));
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void BM_SplitView(benchmark::State& state, const std::string& input,
+                  const std::string& separators) {
+  for (auto _ : state) {
+    for (auto token : SplitView(input, separators)) {
+      benchmark::DoNotOptimize(token);
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+BENCHMARK_CAPTURE(BM_Trim, typical, TypicalInput());
+BENCHMARK_CAPTURE(BM_Trim, whitespace_heavy, WhitespaceHeavyInput());
+BENCHMARK_CAPTURE(BM_TrimLocale, typical, TypicalInput());
+BENCHMARK_CAPTURE(BM_TrimLocale, whitespace_heavy, WhitespaceHeavyInput());
+BENCHMARK_CAPTURE(BM_Split, short_key, ShortKeyInput(), ".");
+BENCHMARK_CAPTURE(BM_Split, long_list, LongListInput(), ", ");
+BENCHMARK_CAPTURE(BM_SplitView, short_key, ShortKeyInput(), ".");
+BENCHMARK_CAPTURE(BM_SplitView, long_list, LongListInput(), ", ");
+
+}  // namespace
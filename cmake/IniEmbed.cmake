@@ -0,0 +1,29 @@
+# ini_embed(<target> <symbol> <ini file>)
+#
+# Compiles the keys of <ini file> into <target> as the sorted, read-only table
+# `const IniEmbeddedTable <symbol>`, declared in the generated `<symbol>.h`.
+# The file is parsed at build time, and again only when it changes.
+set(INI_EMBED_TOOL_SOURCE ${CMAKE_CURRENT_LIST_DIR}/../tools/ini_embed.cc)
+set(INI_EMBED_INCLUDE_DIR ${CMAKE_CURRENT_LIST_DIR}/../include)
+
+function(ini_embed target symbol ini_file)
+  if(NOT TARGET ini_embed)
+    add_executable(ini_embed ${INI_EMBED_TOOL_SOURCE})
+    target_include_directories(ini_embed PRIVATE ${INI_EMBED_INCLUDE_DIR})
+    target_compile_features(ini_embed PRIVATE cxx_std_17)
+  endif()
+  get_filename_component(ini_path ${ini_file} ABSOLUTE)
+  set(out_dir ${CMAKE_CURRENT_BINARY_DIR}/ini_embedded/${target})
+  set(source ${out_dir}/${symbol}.cc)
+  set(header ${out_dir}/${symbol}.h)
+  add_custom_command(
+    OUTPUT ${source} ${header}
+    COMMAND ${CMAKE_COMMAND} -E make_directory ${out_dir}
+    COMMAND ini_embed ${ini_path} ${source} ${header} ${symbol}
+    DEPENDS ini_embed ${ini_path}
+    COMMENT "Embedding ${ini_file} as ${symbol}"
+    VERBATIM)
+  target_sources(${target} PRIVATE ${source} ${header})
+  target_include_directories(${target} PRIVATE ${out_dir}
+                                               ${INI_EMBED_INCLUDE_DIR})
+endfunction()
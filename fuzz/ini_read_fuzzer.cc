@@ -0,0 +1,35 @@
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "settings.h"
+
+// the input is read as an untrusted file: bounded, with every check on.
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data,
+                                      std::size_t size) {
+  std::string content(reinterpret_cast<const char*>(data), size);
+  IniLimits limits{4096, 10000, 4096, 1 << 20};
+  StrStrMap tbl;
+  std::vector<IniInclude> includes;
+  IniSectionParents parents;
+  IniDiagnostics diagnostics;
+  std::istringstream stream(content);
+  ReadIni(stream, tbl,
+          {nullptr, &includes, &parents, nullptr, &diagnostics, nullptr, true,
+           &limits});
+  std::vector<IniViolation> violations;
+  InheritSections(tbl, parents, violations);
+
+  IniSectionIndex index;
+  IndexIniSections(content, index);
+
+  IniDocument document(content);
+  document.SetValue("fuzz.key", " \"va;lue\" \\");
+  std::istringstream written(document.str());
+  StrStrMap reread;
+  ReadIni(written, reread, {nullptr, nullptr, nullptr, nullptr, nullptr,
+                            nullptr, false, &limits});
+  return 0;
+}
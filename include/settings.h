@@ -2,14 +2,23 @@
  * @file settings.h
  * @author Lei Peng (plhitsz@outlook.com)
  * @brief A `ini` configuration file parser written in modern C++.
- * @version 3.2.0
- * @date 2024-05-08
+ * @version 4.0.0
+ * @date 2026-10-17
  *
  */
 #ifndef INCLUDE_SETTINGS_H_
 #define INCLUDE_SETTINGS_H_
 
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
 #include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
 #if __has_include(<filesystem>)
 #include <filesystem>
 namespace std_fs = std::filesystem;
@@ -20,242 +29,3992 @@ namespace std_fs = std::experimental::filesystem;
 error "Missing the <filesystem> header."
 #endif
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
 #include <map>
 #include <memory>
+#include <new>
 #include <mutex>
+#include <optional>
+#include <ratio>
 #include <ostream>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <type_traits>
+#include <unordered_map>
+#include <typeindex>
+#include <typeinfo>
+#include <utility>
 #include <vector>
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define INI_HAS_MMAP 1
+#endif
+
+// Errors are reported by exceptions unless they are disabled, e.g. by
+// `-fno-exceptions`; then the throwing interfaces abort and the `Try*`
+// interfaces are the way to handle errors.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define INI_THROW(exception) throw exception
+#else
+#define INI_THROW(exception) std::abort()
+#endif
 
 using Ch = char;
-using StrStrMap = std::map<std::string, std::string>;
+
+/**
+ * @brief An immutable, reference counted string. Copies share the characters,
+ * so tables can hold the same value many times without duplicating it. The
+ * handle is one pointer and the empty string doesn't allocate.
+ */
+class SharedStr {
+ public:
+  SharedStr() = default;
+  SharedStr(std::string_view str) : rep_(Create(str)) {}  // NOLINT
+  SharedStr(const std::string& str)                       // NOLINT
+      : SharedStr(std::string_view(str)) {}
+  SharedStr(const char* str) : SharedStr(std::string_view(str)) {}  // NOLINT
+  SharedStr(const SharedStr& other) noexcept : rep_(other.rep_) {
+    if (rep_) {
+      rep_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  SharedStr(SharedStr&& other) noexcept : rep_(other.rep_) {
+    other.rep_ = nullptr;
+  }
+  SharedStr& operator=(SharedStr other) noexcept {
+    std::swap(rep_, other.rep_);
+    return *this;
+  }
+  ~SharedStr() {
+    if (rep_ && rep_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      rep_->~Rep();
+      ::operator delete(rep_);
+    }
+  }
+
+  const char* data() const { return rep_ ? rep_->Chars() : ""; }
+  const char* c_str() const { return data(); }
+  std::size_t size() const { return rep_ ? rep_->size : 0; }
+  bool empty() const { return size() == 0; }
+  std::string_view view() const { return {data(), size()}; }
+  operator std::string_view() const { return view(); }  // NOLINT
+  std::string str() const { return std::string(view()); }
+  /// @brief The number of handles sharing the characters, 0 if empty.
+  std::size_t use_count() const {
+    return rep_ ? rep_->refs.load(std::memory_order_relaxed) : 0;
+  }
+  /// @brief Whether `other` shares the characters of this string.
+  bool SharesWith(const SharedStr& other) const { return rep_ == other.rep_; }
+
+  friend bool operator==(const SharedStr& a, const SharedStr& b) {
+    return a.rep_ == b.rep_ || a.view() == b.view();
+  }
+  friend bool operator!=(const SharedStr& a, const SharedStr& b) {
+    return !(a == b);
+  }
+  friend bool operator<(const SharedStr& a, const SharedStr& b) {
+    return a.view() < b.view();
+  }
+  template <typename Str, typename = typename std::enable_if<
+                              std::is_convertible<const Str&,
+                                                  std::string_view>::value &&
+                              !std::is_same<Str, SharedStr>::value>::type>
+  friend bool operator==(const SharedStr& a, const Str& b) {
+    return a.view() == std::string_view(b);
+  }
+  template <typename Str, typename = typename std::enable_if<
+                              std::is_convertible<const Str&,
+                                                  std::string_view>::value &&
+                              !std::is_same<Str, SharedStr>::value>::type>
+  friend bool operator!=(const SharedStr& a, const Str& b) {
+    return a.view() != std::string_view(b);
+  }
+  template <typename Str, typename = typename std::enable_if<
+                              std::is_convertible<const Str&,
+                                                  std::string_view>::value &&
+                              !std::is_same<Str, SharedStr>::value>::type>
+  friend bool operator<(const SharedStr& a, const Str& b) {
+    return a.view() < std::string_view(b);
+  }
+  template <typename Str, typename = typename std::enable_if<
+                              std::is_convertible<const Str&,
+                                                  std::string_view>::value &&
+                              !std::is_same<Str, SharedStr>::value>::type>
+  friend bool operator<(const Str& a, const SharedStr& b) {
+    return std::string_view(a) < b.view();
+  }
+  friend std::ostream& operator<<(std::ostream& os, const SharedStr& str) {
+    return os << str.view();
+  }
+
+ private:
+  // the characters, null-terminated, follow the header in one allocation.
+  struct Rep {
+    std::atomic<std::size_t> refs{1};
+    std::size_t size = 0;
+    char* Chars() { return reinterpret_cast<char*>(this + 1); }
+  };
+  static Rep* Create(std::string_view str) {
+    if (str.empty()) {
+      return nullptr;
+    }
+    void* memory = ::operator new(sizeof(Rep) + str.size() + 1);
+    auto* rep = new (memory) Rep();
+    rep->size = str.size();
+    std::memcpy(rep->Chars(), str.data(), str.size());
+    rep->Chars()[str.size()] = '\0';
+    return rep;
+  }
+  Rep* rep_ = nullptr;
+};
+
+/// @brief Memory statistics of an `IniStringPool`.
+struct IniStringPoolStats {
+  std::size_t strings = 0;      // distinct strings held by the pool.
+  std::size_t bytes = 0;        // characters of those strings.
+  std::size_t lookups = 0;      // calls to `Intern`.
+  std::size_t hits = 0;         // lookups that found the string in the pool.
+  std::size_t saved_bytes = 0;  // characters the hits didn't allocate.
+};
+
+/**
+ * @brief A process-wide, thread-safe pool of the keys and values read from
+ * `ini` files. Identical strings, within a table, across the reloads of a
+ * file and across `Settings` instances, share one allocation.
+ *
+ * The strings are spread over shards with a lock each, so loads in parallel
+ * rarely wait on each other.
+ */
+class IniStringPool {
+ public:
+  static IniStringPool& Instance() {
+    static IniStringPool pool;
+    return pool;
+  }
+
+  /**
+   * @brief The pooled copy of `str`, added to the pool if missing.
+   */
+  SharedStr Intern(std::string_view str) {
+    if (str.empty()) {
+      return {};
+    }
+    auto& shard = ShardOf(str);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.stats.lookups;
+    auto it = shard.strings.find(str);
+    if (it != shard.strings.end()) {
+      ++shard.stats.hits;
+      shard.stats.saved_bytes += str.size();
+      return it->second;
+    }
+    SharedStr pooled(str);
+    // the key views the characters of the pooled string, which never move.
+    shard.strings.emplace(pooled.view(), pooled);
+    ++shard.stats.strings;
+    shard.stats.bytes += str.size();
+    return pooled;
+  }
+
+  /**
+   * @brief Release the strings that are only referenced by the pool.
+   *
+   * @return std::size_t The number of strings released.
+   */
+  std::size_t Prune() {
+    std::size_t released = 0;
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      released += PruneShard(shard);
+    }
+    return released;
+  }
+
+  /**
+   * @brief `Prune` only the shards that doubled since their last prune, for
+   * callers releasing strings often, e.g. every load. A prune then costs about
+   * the strings added since the previous one, rather than the whole pool.
+   *
+   * @return std::size_t The number of strings released.
+   */
+  std::size_t Collect() {
+    std::size_t released = 0;
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      if (shard.strings.size() >= std::max(kMinCollected, 2 * shard.kept)) {
+        released += PruneShard(shard);
+      }
+    }
+    return released;
+  }
+
+  IniStringPoolStats Stats() const {
+    IniStringPoolStats stats;
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      stats.strings += shard.stats.strings;
+      stats.bytes += shard.stats.bytes;
+      stats.lookups += shard.stats.lookups;
+      stats.hits += shard.stats.hits;
+      stats.saved_bytes += shard.stats.saved_bytes;
+    }
+    return stats;
+  }
+
+ private:
+  static constexpr std::size_t kShards = 16;
+  // the strings a shard holds before `Collect` prunes it at all.
+  static constexpr std::size_t kMinCollected = 64;
+  // a cache line each, so the locks of the shards don't share one.
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<std::string_view, SharedStr> strings;
+    IniStringPoolStats stats;
+    // the strings left by the last prune.
+    std::size_t kept = 0;
+  };
+
+  IniStringPool() = default;
+
+  Shard& ShardOf(std::string_view str) {
+    return shards_[std::hash<std::string_view>()(str) % kShards];
+  }
+  static std::size_t PruneShard(Shard& shard) {
+    std::size_t released = 0;
+    for (auto it = shard.strings.begin(); it != shard.strings.end();) {
+      if (it->second.use_count() == 1) {
+        shard.stats.bytes -= it->second.size();
+        it = shard.strings.erase(it);
+        ++released;
+      } else {
+        ++it;
+      }
+    }
+    shard.stats.strings -= released;
+    shard.kept = shard.strings.size();
+    return released;
+  }
+
+  Shard shards_[kShards];
+};
+
+// keys are looked up by any string type without a conversion.
+using StrStrMap = std::map<SharedStr, SharedStr, std::less<>>;
+// the parent of each section declared as `[child : parent]`.
+using IniSectionParents = std::map<std::string, std::string>;
+// the line number of each combined key, starting from 1.
+using IniKeyLines = std::map<std::string, std::size_t>;
+
+/// @brief How a key differs between two tables, see `Diff`.
+enum class IniChangeKind : std::uint8_t {
+  kAdded,
+  kRemoved,
+  kChanged,
+};
+
+/// @brief A key that differs between two tables.
+struct IniChange {
+  IniChangeKind kind;
+  SharedStr key;
+  SharedStr old_value;  // empty when added.
+  SharedStr new_value;  // empty when removed.
+};
+
+/**
+ * @brief An immutable sorted map of keys to values, the table published by
+ * `Settings`. `Set` and `Erase` return a new version that shares all but the
+ * O(log n) nodes on the path to the key with this one, so versions are cheap
+ * to make and to keep, and any thread may read one without a lock.
+ *
+ * A persistent AVL tree: nodes are never modified once built, and a node is
+ * released with the last version that uses it.
+ */
+class IniPersistentMap {
+  struct Node;
+  using NodePtr = std::shared_ptr<const Node>;
+
+ public:
+  using value_type = StrStrMap::value_type;
+
+  /// @brief Visits the entries in key order.
+  class const_iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = IniPersistentMap::value_type;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const value_type*;
+    using reference = const value_type&;
+
+    const_iterator() = default;
+    reference operator*() const { return path_.back()->entry; }
+    pointer operator->() const { return &path_.back()->entry; }
+    const_iterator& operator++() {
+      const Node* node = path_.back();
+      path_.pop_back();
+      PushLeft(node->right.get());
+      return *this;
+    }
+    const_iterator operator++(int) {
+      auto copy = *this;
+      ++*this;
+      return copy;
+    }
+    bool operator==(const const_iterator& other) const {
+      return path_ == other.path_;
+    }
+    bool operator!=(const const_iterator& other) const {
+      return path_ != other.path_;
+    }
+
+   private:
+    friend class IniPersistentMap;
+    explicit const_iterator(const Node* root) { PushLeft(root); }
+    void PushLeft(const Node* node) {
+      for (; node; node = node->left.get()) {
+        path_.push_back(node);
+      }
+    }
+    // the nodes whose entry and right subtree are still to visit.
+    std::vector<const Node*> path_;
+  };
+
+  IniPersistentMap() = default;
+  /// @brief A balanced map of the entries of `tbl`, built in O(n).
+  explicit IniPersistentMap(const StrStrMap& tbl) : size_(tbl.size()) {
+    auto it = tbl.begin();
+    root_ = Build(it, tbl.size());
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const_iterator begin() const { return const_iterator(root_.get()); }
+  const_iterator end() const { return {}; }
+
+  /// @brief The value of `key`, nullptr if it's missing.
+  const SharedStr* Find(std::string_view key) const {
+    for (const Node* node = root_.get(); node;) {
+      int order = key.compare(node->entry.first.view());
+      if (order == 0) {
+        return &node->entry.second;
+      }
+      node = order < 0 ? node->left.get() : node->right.get();
+    }
+    return nullptr;
+  }
+  /**
+   * @brief This map with `key` set to `value`, in O(log n). If `key` already
+   * has `value`, the new map shares every node with this one.
+   */
+  IniPersistentMap Set(const SharedStr& key, const SharedStr& value) const {
+    IniPersistentMap map;
+    map.size_ = size_;
+    map.root_ = Insert(root_, key, value, map.size_);
+    return map;
+  }
+  /// @brief This map without `key`, in O(log n).
+  IniPersistentMap Erase(std::string_view key) const {
+    IniPersistentMap map;
+    map.size_ = size_;
+    map.root_ = Remove(root_, key, map.size_);
+    return map;
+  }
+  /**
+   * @brief This map changed into `tbl`, e.g. the table of a reload: the
+   * changes are found in one pass over both, and when they are few the new map
+   * keeps the nodes of the unchanged entries. Unchanged, it is this map.
+   */
+  IniPersistentMap Update(const StrStrMap& tbl) const {
+    std::vector<const value_type*> sets;
+    std::vector<const SharedStr*> erases;
+    auto it = begin();
+    auto other = tbl.begin();
+    while (it != end() || other != tbl.end()) {
+      if (other == tbl.end() || (it != end() && it->first < other->first)) {
+        erases.push_back(&it->first);
+        ++it;
+      } else if (it == end() || other->first < it->first) {
+        sets.push_back(&*other);
+        ++other;
+      } else {
+        if (it->second != other->second) {
+          sets.push_back(&*other);
+        }
+        ++it;
+        ++other;
+      }
+    }
+    // a path per change costs more than a new tree past a change in 16.
+    if ((sets.size() + erases.size()) * 16 > tbl.size()) {
+      return IniPersistentMap(tbl);
+    }
+    IniPersistentMap map = *this;
+    for (const auto* entry : sets) {
+      map = map.Set(entry->first, entry->second);
+    }
+    for (const auto* key : erases) {
+      map = map.Erase(*key);
+    }
+    return map;
+  }
+  /// @brief Whether both maps are the same version, in O(1).
+  bool SharesWith(const IniPersistentMap& other) const {
+    return root_ == other.root_;
+  }
+  friend std::vector<IniChange> Diff(const IniPersistentMap& from,
+                                     const IniPersistentMap& to);
+  /// @brief The memory of one entry besides its characters, for estimates.
+  static constexpr std::size_t NodeBytes() {
+    // the node and the reference counts allocated with it.
+    return sizeof(Node) + 2 * sizeof(void*);
+  }
+
+ private:
+  struct Node {
+    Node(const SharedStr& key, const SharedStr& value, NodePtr left_node,
+         NodePtr right_node)
+        : entry(key, value),
+          left(std::move(left_node)),
+          right(std::move(right_node)),
+          height(1 + std::max(Height(left), Height(right))) {}
+    value_type entry;
+    NodePtr left;
+    NodePtr right;
+    int height;
+  };
+
+  static int Height(const NodePtr& node) { return node ? node->height : 0; }
+  static NodePtr Make(const value_type& entry, NodePtr left, NodePtr right) {
+    return std::make_shared<const Node>(entry.first, entry.second,
+                                        std::move(left), std::move(right));
+  }
+  // `entry` over `left` and `right`, whose heights differ by 2 at most.
+  static NodePtr Balance(const value_type& entry, NodePtr left,
+                         NodePtr right) {
+    if (Height(left) > Height(right) + 1) {
+      if (Height(left->left) >= Height(left->right)) {
+        return Make(left->entry, left->left,
+                    Make(entry, left->right, std::move(right)));
+      }
+      const Node& pivot = *left->right;
+      return Make(pivot.entry, Make(left->entry, left->left, pivot.left),
+                  Make(entry, pivot.right, std::move(right)));
+    }
+    if (Height(right) > Height(left) + 1) {
+      if (Height(right->right) >= Height(right->left)) {
+        return Make(right->entry, Make(entry, std::move(left), right->left),
+                    right->right);
+      }
+      const Node& pivot = *right->left;
+      return Make(pivot.entry, Make(entry, std::move(left), pivot.left),
+                  Make(right->entry, pivot.right, right->right));
+    }
+    return Make(entry, std::move(left), std::move(right));
+  }
+  // the `count` entries from `it`, which is advanced past them.
+  static NodePtr Build(StrStrMap::const_iterator& it, std::size_t count) {
+    if (count == 0) {
+      return nullptr;
+    }
+    auto left = Build(it, count / 2);
+    const auto& entry = *it++;
+    auto right = Build(it, count - count / 2 - 1);
+    return Make(entry, std::move(left), std::move(right));
+  }
+  static NodePtr Insert(const NodePtr& node, const SharedStr& key,
+                        const SharedStr& value, std::size_t& size) {
+    if (!node) {
+      ++size;
+      return std::make_shared<const Node>(key, value, nullptr, nullptr);
+    }
+    int order = key.view().compare(node->entry.first.view());
+    if (order < 0) {
+      auto left = Insert(node->left, key, value, size);
+      return left == node->left ? node
+                                : Balance(node->entry, std::move(left),
+                                          node->right);
+    }
+    if (order > 0) {
+      auto right = Insert(node->right, key, value, size);
+      return right == node->right ? node
+                                  : Balance(node->entry, node->left,
+                                            std::move(right));
+    }
+    if (node->entry.second == value) {
+      return node;
+    }
+    return std::make_shared<const Node>(node->entry.first, value, node->left,
+                                        node->right);
+  }
+  static NodePtr Remove(const NodePtr& node, std::string_view key,
+                        std::size_t& size) {
+    if (!node) {
+      return nullptr;
+    }
+    int order = key.compare(node->entry.first.view());
+    if (order < 0) {
+      auto left = Remove(node->left, key, size);
+      return left == node->left ? node
+                                : Balance(node->entry, std::move(left),
+                                          node->right);
+    }
+    if (order > 0) {
+      auto right = Remove(node->right, key, size);
+      return right == node->right ? node
+                                  : Balance(node->entry, node->left,
+                                            std::move(right));
+    }
+    --size;
+    if (!node->left || !node->right) {
+      return node->left ? node->left : node->right;
+    }
+    // the successor takes the place of the node.
+    const Node* successor = nullptr;
+    auto right = RemoveMin(node->right, successor);
+    return Balance(successor->entry, node->left, std::move(right));
+  }
+  static NodePtr RemoveMin(const NodePtr& node, const Node*& min) {
+    if (!node->left) {
+      min = node.get();
+      return node->right;
+    }
+    return Balance(node->entry, RemoveMin(node->left, min), node->right);
+  }
+
+  // the walk of `Diff` over a map: what is left of it in key order, the next
+  // part on top, as subtrees not visited yet and entries whose left subtree
+  // was visited.
+  struct Cursor {
+    struct Part {
+      const Node* node;
+      bool subtree;
+    };
+    explicit Cursor(const NodePtr& root) { PushSubtree(root.get()); }
+    void PushSubtree(const Node* node) {
+      if (node) {
+        parts.push_back({node, true});
+      }
+    }
+    // the subtree on top becomes its left subtree, its entry and its right
+    // subtree.
+    void Open() {
+      const Node* node = parts.back().node;
+      parts.pop_back();
+      PushSubtree(node->right.get());
+      parts.push_back({node, false});
+      PushSubtree(node->left.get());
+    }
+    std::vector<Part> parts;
+  };
+
+  NodePtr root_;
+  std::size_t size_ = 0;
+};
+
+/**
+ * @brief The keys added, removed or changed from `from` to `to`, in key order.
+ * Both maps are walked once together and the subtrees they share are skipped,
+ * so between two versions of a table, e.g. two `Versions()` of a `Settings`,
+ * the cost grows with the changes rather than with the size of the table.
+ */
+inline std::vector<IniChange> Diff(const IniPersistentMap& from,
+                                   const IniPersistentMap& to) {
+  std::vector<IniChange> changes;
+  IniPersistentMap::Cursor old_rest(from.root_);
+  IniPersistentMap::Cursor new_rest(to.root_);
+  auto& old_parts = old_rest.parts;
+  auto& new_parts = new_rest.parts;
+  while (!old_parts.empty() || !new_parts.empty()) {
+    if (old_parts.empty() || new_parts.empty()) {
+      auto& rest = old_parts.empty() ? new_rest : old_rest;
+      if (rest.parts.back().subtree) {
+        rest.Open();
+        continue;
+      }
+      const auto& [key, value] = rest.parts.back().node->entry;
+      if (old_parts.empty()) {
+        changes.push_back({IniChangeKind::kAdded, key, {}, value});
+      } else {
+        changes.push_back({IniChangeKind::kRemoved, key, value, {}});
+      }
+      rest.parts.pop_back();
+      continue;
+    }
+    auto old_part = old_parts.back();
+    auto new_part = new_parts.back();
+    if (old_part.subtree || new_part.subtree) {
+      if (old_part.subtree && new_part.subtree &&
+          old_part.node == new_part.node) {
+        old_parts.pop_back();
+        new_parts.pop_back();
+      } else if (old_part.subtree &&
+                 (!new_part.subtree ||
+                  old_part.node->height >= new_part.node->height)) {
+        // a shared subtree has the same height in both maps.
+        old_rest.Open();
+      } else {
+        new_rest.Open();
+      }
+      continue;
+    }
+    const auto& old_entry = old_part.node->entry;
+    const auto& new_entry = new_part.node->entry;
+    int order = old_entry.first.view().compare(new_entry.first.view());
+    if (order < 0) {
+      changes.push_back(
+          {IniChangeKind::kRemoved, old_entry.first, old_entry.second, {}});
+      old_parts.pop_back();
+    } else if (order > 0) {
+      changes.push_back(
+          {IniChangeKind::kAdded, new_entry.first, {}, new_entry.second});
+      new_parts.pop_back();
+    } else {
+      if (old_part.node != new_part.node &&
+          old_entry.second != new_entry.second) {
+        changes.push_back({IniChangeKind::kChanged, old_entry.first,
+                           old_entry.second, new_entry.second});
+      }
+      old_parts.pop_back();
+      new_parts.pop_back();
+    }
+  }
+  return changes;
+}
+
+// a published version of the table of a `Settings`, see `Snapshot`.
+using IniSnapshot = IniPersistentMap;
+
+/// @brief An `@include <path>` directive.
+struct IniInclude {
+  std::string path;  // as written, relative to the including file.
+  std::size_t line = 0;
+};
+
+/// @brief The kinds of problems `ReadIni` reports.
+enum class IniDiagnosticKind : std::uint8_t {
+  kUnmatchedBracket,  // a section header without `]`.
+  kDuplicateSection,  // a section header seen before in the same file.
+  kMissingEquals,     // a line that is neither a header nor `key = value`.
+  kEmptyKey,          // a line starting with `=`.
+  kDuplicateKey,      // a key seen before in the same section.
+  kUnterminatedQuote,  // a quoted value without its closing quote.
+  kInvalidUtf8,        // the first ill-formed UTF-8 sequence of the file.
+  // a limit of `IniLimits` was reached, the parse stopped there.
+  kLineTooLong,
+  kTooManyKeys,
+  kValueTooLarge,
+  kFileTooLarge,
+};
+
+/// @brief Return a static description of `kind`, never allocates.
+inline const char* IniDiagnosticMessage(IniDiagnosticKind kind) {
+  switch (kind) {
+    case IniDiagnosticKind::kUnmatchedBracket:
+      return "unmatched '['";
+    case IniDiagnosticKind::kDuplicateSection:
+      return "duplicated section name";
+    case IniDiagnosticKind::kMissingEquals:
+      return "unmatched '='";
+    case IniDiagnosticKind::kEmptyKey:
+      return "unmatched key";
+    case IniDiagnosticKind::kDuplicateKey:
+      return "duplicated key name";
+    case IniDiagnosticKind::kUnterminatedQuote:
+      return "unterminated quote";
+    case IniDiagnosticKind::kInvalidUtf8:
+      return "invalid UTF-8";
+    case IniDiagnosticKind::kLineTooLong:
+      return "line too long";
+    case IniDiagnosticKind::kTooManyKeys:
+      return "too many keys";
+    case IniDiagnosticKind::kValueTooLarge:
+      return "value too large";
+    case IniDiagnosticKind::kFileTooLarge:
+      return "file too large";
+  }
+  return "unknown";
+}
+
+/// @brief A problem found by `ReadIni`, the positions start from 1.
+struct IniDiagnostic {
+  IniDiagnosticKind kind;
+  std::uint32_t line;
+  std::uint32_t column;
+  std::uint64_t offset;  // of the reported character, from 0.
+};
+
+/// @brief Collects the diagnostics of a parse, up to `limit` of them.
+struct IniDiagnostics {
+  std::vector<IniDiagnostic> entries;
+  // the diagnostics past the limit are only counted.
+  std::size_t limit = 64;
+  std::size_t dropped = 0;
+  // called with each recorded diagnostic, when set.
+  std::function<void(const IniDiagnostic&)> sink;
+
+  void Add(const IniDiagnostic& diagnostic) {
+    if (entries.size() >= limit) {
+      ++dropped;
+      return;
+    }
+    entries.push_back(diagnostic);
+    if (sink) {
+      sink(diagnostic);
+    }
+  }
+};
+
+/**
+ * @brief Bounds of a parse of untrusted input, 0 means no bound. `ReadIni`
+ * stops at the first line past a bound, so the time and memory of a parse are
+ * linear in the bounds rather than in the input.
+ */
+struct IniLimits {
+  // the bytes of a line, without its newline.
+  std::size_t max_line_bytes = 0;
+  // the key lines, duplicated keys included.
+  std::size_t max_keys = 0;
+  // the bytes of a value, continuation lines included.
+  std::size_t max_value_bytes = 0;
+  // the bytes of the input.
+  std::size_t max_total_bytes = 0;
+
+  bool IsUnlimited() const {
+    return max_line_bytes == 0 && max_keys == 0 && max_value_bytes == 0 &&
+           max_total_bytes == 0;
+  }
+};
+
+/// @brief Optional outputs of `ReadIni`, the null ones are not collected.
+struct IniReadContext {
+  // the line of each key.
+  IniKeyLines* key_lines = nullptr;
+  // the `@include` directives; they are ignored when null.
+  std::vector<IniInclude>* includes = nullptr;
+  // the parents of the `[child : parent]` sections.
+  IniSectionParents* parents = nullptr;
+  // interns the keys and values when set.
+  IniStringPool* pool = nullptr;
+  // the problems of the file; they are ignored when null.
+  IniDiagnostics* diagnostics = nullptr;
+  // trims the whitespaces of this locale rather than the ASCII ones when set.
+  const std::locale* locale = nullptr;
+  // reports the first ill-formed UTF-8 sequence to `diagnostics`.
+  bool validate_utf8 = false;
+  // stops the parse past these bounds when set.
+  const IniLimits* limits = nullptr;
+};
 
 template <typename T, typename U>
 struct is_decay_equiv : std::is_same<typename std::decay<T>::type, U>::type {};
 
-// we only support std::string, int, float, double and bool ...
+/**
+ * @brief Customization point describing how a value of type `T` is parsed from
+ * and formatted to its `ini` text. A specialization provides:
+ *
+ *   static std::errc Parse(std::string_view text, T& out);
+ *   static std::string Format(const T& value);
+ *
+ * `Parse` follows the `std::from_chars` conventions: it returns `std::errc{}`
+ * on success, `std::errc::invalid_argument` for malformed text and
+ * `std::errc::result_out_of_range` when the value doesn't fit in `T`.
+ * Built-in specializations cover std::string, bool, all integer widths,
+ * floating point types, enums, std::chrono durations and std::optional.
+ */
+template <typename T, typename Enable = void>
+struct ValueTraits {};
+
+/**
+ * @brief Name table of an enum `E`, used by `ValueTraits` to read and write
+ * enumerators by name. Specialize it with a constexpr array, e.g.
+ *
+ *   template <>
+ *   struct EnumNames<Color> {
+ *     static constexpr std::pair<std::string_view, Color> kNames[] = {
+ *         {"red", Color::kRed}, {"green", Color::kGreen}};
+ *   };
+ *
+ * Enums without a name table are read and written as their underlying value.
+ */
+template <typename E>
+struct EnumNames {};
+
+template <typename E, typename = void>
+struct has_enum_names : std::false_type {};
+template <typename E>
+struct has_enum_names<E, std::void_t<decltype(EnumNames<E>::kNames)>>
+    : std::true_type {};
+
+template <typename T, typename = void>
+struct is_supported_value : std::false_type {};
+template <typename T>
+struct is_supported_value<
+    T, std::void_t<decltype(ValueTraits<T>::Parse(
+                       std::declval<std::string_view>(), std::declval<T&>())),
+                   decltype(ValueTraits<T>::Format(std::declval<const T&>()))>>
+    : std::true_type {};
+
+// every type with a `ValueTraits` specialization is supported.
 template <class T = void>
 using enable_if_supported_type = typename std::enable_if<
-    is_decay_equiv<T, std::string>::value || is_decay_equiv<T, int>::value ||
-        is_decay_equiv<T, float>::value || is_decay_equiv<T, double>::value ||
-        is_decay_equiv<T, bool>::value,
-    bool>::type;
+    is_supported_value<typename std::decay<T>::type>::value, bool>::type;
+
+/// @brief Lower-case the ASCII letter `ch`, other bytes are returned as is.
+inline constexpr char ToLowerAscii(char ch) {
+  return (ch >= 'A' && ch <= 'Z') ? static_cast<char>(ch - 'A' + 'a') : ch;
+}
+
+/// @brief ASCII case-insensitive comparison of `a` and `b`.
+inline bool EqualsNoCase(std::string_view a, std::string_view b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i) {
+    if (ToLowerAscii(a[i]) != ToLowerAscii(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
 /**
- * @brief Return the value by the type of `T`. if the value is empty, return the
- * `default_value`
- *
- * @tparam T The expected type of the value.
- * @param value The value read from the `ini` file.
- * @param default_value The default value.
- * @return T
+ * @brief Lower-case the ASCII letters of the `size` bytes of `in` into `out`,
+ * which may be `in`. Eight bytes are folded at once in a 64-bit word; the
+ * other bytes, UTF-8 sequences included, are copied as is.
  */
-template <typename T, enable_if_supported_type<T> = 0>
-T ConvertValue(const std::string& value, const T& default_value) {
-  if (value.empty()) {
-    return default_value;
+inline void FoldAsciiCase(const char* in, std::size_t size, char* out) {
+  constexpr std::uint64_t kOnes = 0x0101010101010101ULL;
+  std::size_t i = 0;
+  for (; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+    std::uint64_t word = 0;
+    std::memcpy(&word, in + i, sizeof(word));
+    // the high bit of a byte is set when its low 7 bits are >= 'A' and not
+    // > 'Z', and kept for the ASCII bytes only; it becomes the 0x20 bit.
+    std::uint64_t low = word & (0x7f * kOnes);
+    std::uint64_t ge_a = low + (0x80 - 'A') * kOnes;
+    std::uint64_t gt_z = low + (0x80 - 'Z' - 1) * kOnes;
+    word |= ((ge_a ^ gt_z) & ~word & (0x80 * kOnes)) >> 2;
+    std::memcpy(out + i, &word, sizeof(word));
+  }
+  for (; i < size; ++i) {
+    out[i] = ToLowerAscii(in[i]);
+  }
+}
+
+/// @brief Return `text` with its ASCII letters lower-cased.
+inline std::string FoldAsciiCase(std::string_view text) {
+  std::string folded(text.size(), '\0');
+  FoldAsciiCase(text.data(), text.size(), folded.data());
+  return folded;
+}
+
+/// @brief The byte order mark some editors write at the start of UTF-8 files.
+constexpr std::string_view kUtf8Bom = "\xEF\xBB\xBF";
+
+/// @brief Return the size of the UTF-8 byte order mark `text` starts with.
+inline std::size_t Utf8BomSize(std::string_view text) {
+  return text.compare(0, kUtf8Bom.size(), kUtf8Bom) == 0 ? kUtf8Bom.size() : 0;
+}
+
+/**
+ * @brief Return the offset of the first ill-formed UTF-8 sequence of `text`,
+ * or npos if it is valid. Overlong forms, surrogates and code points past
+ * U+10FFFF are ill-formed. ASCII runs are skipped eight bytes at a time, so
+ * mostly ASCII text costs about one load per word.
+ */
+inline std::size_t FindInvalidUtf8(std::string_view text) {
+  constexpr std::uint64_t kHighBits = 0x8080808080808080ULL;
+  const auto* bytes = reinterpret_cast<const unsigned char*>(text.data());
+  std::size_t size = text.size();
+  std::size_t i = 0;
+  while (i < size) {
+    if (i + sizeof(std::uint64_t) <= size) {
+      std::uint64_t word = 0;
+      std::memcpy(&word, bytes + i, sizeof(word));
+      if ((word & kHighBits) == 0) {
+        i += sizeof(word);
+        continue;
+      }
+    }
+    unsigned char lead = bytes[i];
+    if (lead < 0x80) {
+      ++i;
+      continue;
+    }
+    // the length of the sequence, and the range of its second byte.
+    std::size_t length = 0;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      low = lead == 0xE0 ? 0xA0 : low;
+      high = lead == 0xED ? 0x9F : high;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      low = lead == 0xF0 ? 0x90 : low;
+      high = lead == 0xF4 ? 0x8F : high;
+    } else {
+      return i;
+    }
+    if (size - i < length || bytes[i + 1] < low || bytes[i + 1] > high) {
+      return i;
+    }
+    for (std::size_t k = 2; k < length; ++k) {
+      if ((bytes[i + k] & 0xC0) != 0x80) {
+        return i;
+      }
+    }
+    i += length;
+  }
+  return std::string_view::npos;
+}
+
+/// @brief 64-bit FNV-1a hash of `data`.
+inline std::uint64_t HashBytes(std::string_view data) {
+  std::uint64_t hash = 14695981039346656037ULL;
+  for (char ch : data) {
+    hash ^= static_cast<unsigned char>(ch);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+template <>
+struct ValueTraits<std::string> {
+  static std::errc Parse(std::string_view text, std::string& out) {
+    out.assign(text.data(), text.size());
+    return std::errc{};
+  }
+  static std::string Format(const std::string& value) { return value; }
+};
+
+template <>
+struct ValueTraits<bool> {
+  static std::errc Parse(std::string_view text, bool& out) {
+    if (text == "1" || EqualsNoCase(text, "true") ||
+        EqualsNoCase(text, "yes") || EqualsNoCase(text, "on")) {
+      out = true;
+      return std::errc{};
+    }
+    if (text == "0" || EqualsNoCase(text, "false") ||
+        EqualsNoCase(text, "no") || EqualsNoCase(text, "off")) {
+      out = false;
+      return std::errc{};
+    }
+    return std::errc::invalid_argument;
+  }
+  // keep the "1"/"0" spelling that `std::to_string` used to produce.
+  static std::string Format(const bool& value) { return value ? "1" : "0"; }
+};
+
+template <typename T>
+struct ValueTraits<T, typename std::enable_if<
+                          std::is_integral<T>::value &&
+                          !std::is_same<T, bool>::value>::type> {
+  static std::errc Parse(std::string_view text, T& out) {
+    const char* first = text.data();
+    const char* last = text.data() + text.size();
+    if (first != last && *first == '+') {
+      ++first;
+    }
+    int base = 10;
+    if (last - first > 2 && first[0] == '0' &&
+        (first[1] == 'x' || first[1] == 'X')) {
+      first += 2;
+      base = 16;
+    }
+    // `from_chars` takes a `-`, which may not follow a `+` or `0x`.
+    if (first != text.data() && first != last &&
+        (*first == '-' || *first == '+')) {
+      return std::errc::invalid_argument;
+    }
+    auto [ptr, ec] = std::from_chars(first, last, out, base);
+    if (ec != std::errc{}) {
+      return ec;
+    }
+    return ptr == last ? std::errc{} : std::errc::invalid_argument;
+  }
+  static std::string Format(const T& value) {
+    // digits, sign and the digit `digits10` doesn't account for.
+    constexpr std::size_t kBufSize = std::numeric_limits<T>::digits10 + 3;
+    char buf[kBufSize];
+    auto res = std::to_chars(buf, buf + kBufSize, value);
+    return std::string(buf, res.ptr);
+  }
+};
+
+template <typename T>
+struct ValueTraits<
+    T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+  static std::errc Parse(std::string_view text, T& out) {
+    const char* first = text.data();
+    const char* last = text.data() + text.size();
+    if (first != last && *first == '+') {
+      ++first;
+      // `from_chars` takes a `-`, which may not follow the `+`.
+      if (first != last && (*first == '-' || *first == '+')) {
+        return std::errc::invalid_argument;
+      }
+    }
+    auto [ptr, ec] = std::from_chars(first, last, out);
+    if (ec != std::errc{}) {
+      return ec;
+    }
+    return ptr == last ? std::errc{} : std::errc::invalid_argument;
+  }
+  // keep the fixed notation that `std::to_string` used to produce.
+  static std::string Format(const T& value) { return std::to_string(value); }
+};
+
+template <typename E>
+struct ValueTraits<E, typename std::enable_if<std::is_enum<E>::value>::type> {
+  using Underlying = typename std::underlying_type<E>::type;
+  static std::errc Parse(std::string_view text, E& out) {
+    if constexpr (has_enum_names<E>::value) {
+      for (const auto& [name, value] : EnumNames<E>::kNames) {
+        if (name == text) {
+          out = value;
+          return std::errc{};
+        }
+      }
+    }
+    Underlying raw{};
+    auto ec = ValueTraits<Underlying>::Parse(text, raw);
+    if (ec == std::errc{}) {
+      out = static_cast<E>(raw);
+    }
+    return ec;
+  }
+  static std::string Format(const E& value) {
+    if constexpr (has_enum_names<E>::value) {
+      for (const auto& [name, enumerator] : EnumNames<E>::kNames) {
+        if (enumerator == value) {
+          return std::string(name);
+        }
+      }
+    }
+    return ValueTraits<Underlying>::Format(static_cast<Underlying>(value));
+  }
+};
+
+/**
+ * @brief Scan the non-negative decimal number, e.g. `12` or `1.5`, at the
+ * front of `text` and advance `text` past it.
+ *
+ * @param text The input, advanced past the number on success.
+ * @param whole The integer part.
+ * @param fraction The fractional part, in [0, 1).
+ * @return false if `text` doesn't start with a number or the integer part
+ * overflows.
+ */
+inline bool ScanDecimal(std::string_view& text, std::uint64_t& whole,
+                        double& fraction) {
+  std::size_t pos = 0;
+  whole = 0;
+  fraction = 0;
+  while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+    auto digit = static_cast<std::uint64_t>(text[pos] - '0');
+    if (whole > (std::numeric_limits<std::uint64_t>::max() - digit) / 10) {
+      return false;
+    }
+    whole = whole * 10 + digit;
+    ++pos;
+  }
+  bool has_digits = pos > 0;
+  if (pos < text.size() && text[pos] == '.') {
+    ++pos;
+    double scale = 0.1;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+      fraction += (text[pos] - '0') * scale;
+      scale /= 10;
+      has_digits = true;
+      ++pos;
+    }
+  }
+  text.remove_prefix(pos);
+  return has_digits;
+}
+
+/**
+ * @brief Multiply `whole + fraction` by `unit`, checking for overflow.
+ *
+ * @return false if the result doesn't fit in `out`.
+ */
+inline bool ScaleDecimal(std::uint64_t whole, double fraction,
+                         std::uint64_t unit, std::uint64_t& out) {
+  if (whole != 0 && unit > std::numeric_limits<std::uint64_t>::max() / whole) {
+    return false;
+  }
+  auto extra = static_cast<std::uint64_t>(fraction * static_cast<double>(unit));
+  out = whole * unit;
+  if (out > std::numeric_limits<std::uint64_t>::max() - extra) {
+    return false;
+  }
+  out += extra;
+  return true;
+}
+
+/**
+ * @brief Parse a byte size such as `512`, `64KiB`, `1.5GB` or `2 TiB`. Decimal
+ * units (KB, MB, ...) are powers of 1000, binary units (KiB, MiB, ...) powers of
+ * 1024; units are case-insensitive and `K`/`M`/`G`/`T`/`P` alone are decimal.
+ *
+ * @param text The trimmed text.
+ * @param bytes The parsed size.
+ * @return std::errc Same conventions as `ValueTraits::Parse`.
+ */
+inline std::errc ParseByteSize(std::string_view text, std::uint64_t& bytes) {
+  std::uint64_t whole = 0;
+  double fraction = 0;
+  if (!ScanDecimal(text, whole, fraction)) {
+    return text.empty() || (text[0] >= '0' && text[0] <= '9')
+               ? std::errc::result_out_of_range
+               : std::errc::invalid_argument;
+  }
+  while (!text.empty() && text.front() == ' ') {
+    text.remove_prefix(1);
+  }
+  std::uint64_t unit = 1;
+  if (!text.empty()) {
+    static constexpr char kPrefixes[] = "kmgtp";
+    const char* prefix = nullptr;
+    for (const char* p = kPrefixes; *p; ++p) {
+      if (ToLowerAscii(text.front()) == *p) {
+        prefix = p;
+      }
+    }
+    if (prefix) {
+      text.remove_prefix(1);
+      bool binary = !text.empty() && ToLowerAscii(text.front()) == 'i';
+      if (binary) {
+        text.remove_prefix(1);
+      }
+      for (const char* p = kPrefixes; p <= prefix; ++p) {
+        unit *= binary ? 1024 : 1000;
+      }
+    }
+    if (!text.empty() && ToLowerAscii(text.front()) == 'b') {
+      text.remove_prefix(1);
+    }
+    if (!text.empty()) {
+      return std::errc::invalid_argument;
+    }
+  }
+  return ScaleDecimal(whole, fraction, unit, bytes)
+             ? std::errc{}
+             : std::errc::result_out_of_range;
+}
+
+/**
+ * @brief Parse a duration such as `250ms`, `1.5s`, `2h` or `1h30m`. Units are
+ * `ns`, `us`, `ms`, `s`, `m`, `h` and `d`; several components are summed.
+ *
+ * @param text The trimmed text.
+ * @param out The parsed duration.
+ * @return std::errc Same conventions as `ValueTraits::Parse`.
+ */
+inline std::errc ParseDuration(std::string_view text,
+                               std::chrono::nanoseconds& out) {
+  static constexpr std::pair<std::string_view, std::uint64_t> kUnits[] = {
+      {"ns", 1ULL},
+      {"us", 1000ULL},
+      {"ms", 1000ULL * 1000},
+      {"s", 1000ULL * 1000 * 1000},
+      {"m", 60ULL * 1000 * 1000 * 1000},
+      {"h", 3600ULL * 1000 * 1000 * 1000},
+      {"d", 86400ULL * 1000 * 1000 * 1000}};
+  if (text.empty()) {
+    return std::errc::invalid_argument;
+  }
+  std::uint64_t total = 0;
+  while (!text.empty()) {
+    std::uint64_t whole = 0;
+    double fraction = 0;
+    if (!ScanDecimal(text, whole, fraction)) {
+      return text.empty() || (text[0] >= '0' && text[0] <= '9')
+                 ? std::errc::result_out_of_range
+                 : std::errc::invalid_argument;
+    }
+    std::size_t unit_len = 0;
+    while (unit_len < text.size() &&
+           ToLowerAscii(text[unit_len]) >= 'a' &&
+           ToLowerAscii(text[unit_len]) <= 'z') {
+      ++unit_len;
+    }
+    std::uint64_t unit = 0;
+    for (const auto& [name, ns] : kUnits) {
+      if (EqualsNoCase(text.substr(0, unit_len), name)) {
+        unit = ns;
+      }
+    }
+    if (unit == 0) {
+      return std::errc::invalid_argument;
+    }
+    text.remove_prefix(unit_len);
+    std::uint64_t part = 0;
+    if (!ScaleDecimal(whole, fraction, unit, part) ||
+        part > static_cast<std::uint64_t>(
+                   std::numeric_limits<std::int64_t>::max()) - total) {
+      return std::errc::result_out_of_range;
+    }
+    total += part;
+  }
+  out = std::chrono::nanoseconds(static_cast<std::int64_t>(total));
+  return std::errc{};
+}
+
+/// @brief A size in bytes, written with an optional unit, e.g. `64MiB`.
+struct ByteSize {
+  std::uint64_t bytes = 0;
+  bool operator==(const ByteSize& other) const { return bytes == other.bytes; }
+};
+
+template <>
+struct ValueTraits<ByteSize> {
+  static std::errc Parse(std::string_view text, ByteSize& out) {
+    return ParseByteSize(text, out.bytes);
+  }
+  // the largest binary unit that represents the size exactly.
+  static std::string Format(const ByteSize& value) {
+    static constexpr std::string_view kUnits[] = {"KiB", "MiB", "GiB", "TiB",
+                                                  "PiB"};
+    std::uint64_t count = value.bytes;
+    std::string_view unit;
+    for (auto next_unit : kUnits) {
+      if (count == 0 || count % 1024 != 0) {
+        break;
+      }
+      count /= 1024;
+      unit = next_unit;
+    }
+    return ValueTraits<std::uint64_t>::Format(count) + std::string(unit);
+  }
+};
+
+template <typename Rep, typename Period>
+struct ValueTraits<std::chrono::duration<Rep, Period>> {
+  using Duration = std::chrono::duration<Rep, Period>;
+  // either a plain count of `Period` ticks, e.g. "250" for 250ms, or a value
+  // with units, e.g. "1.5s", truncated to `Period`.
+  static std::errc Parse(std::string_view text, Duration& out) {
+    if (!text.empty() && text.back() >= '0' && text.back() <= '9') {
+      Rep count{};
+      auto ec = ValueTraits<Rep>::Parse(text, count);
+      if (ec == std::errc{}) {
+        out = Duration(count);
+      }
+      return ec;
+    }
+    std::chrono::nanoseconds ns{};
+    auto ec = ParseDuration(text, ns);
+    if (ec == std::errc{}) {
+      out = std::chrono::duration_cast<Duration>(ns);
+    }
+    return ec;
+  }
+  // the count followed by the unit of `Period` when it has one.
+  static std::string Format(const Duration& value) {
+    return ValueTraits<Rep>::Format(value.count()) + std::string(UnitName());
+  }
+
+ private:
+  static constexpr std::string_view UnitName() {
+    if constexpr (std::is_same<Period, std::nano>::value) {
+      return "ns";
+    } else if constexpr (std::is_same<Period, std::micro>::value) {
+      return "us";
+    } else if constexpr (std::is_same<Period, std::milli>::value) {
+      return "ms";
+    } else if constexpr (std::is_same<Period, std::ratio<1>>::value) {
+      return "s";
+    } else if constexpr (std::is_same<Period, std::ratio<60>>::value) {
+      return "m";
+    } else if constexpr (std::is_same<Period, std::ratio<3600>>::value) {
+      return "h";
+    } else {
+      return "";
+    }
+  }
+};
+
+template <typename T>
+struct ValueTraits<
+    std::optional<T>,
+    typename std::enable_if<is_supported_value<T>::value>::type> {
+  static std::errc Parse(std::string_view text, std::optional<T>& out) {
+    T value{};
+    auto ec = ValueTraits<T>::Parse(text, value);
+    if (ec == std::errc{}) {
+      out = std::move(value);
+    }
+    return ec;
+  }
+  // an empty optional is written as an empty value, which removes the key.
+  static std::string Format(const std::optional<T>& value) {
+    return value ? ValueTraits<T>::Format(*value) : std::string();
+  }
+};
+
+/// @brief Error codes of the non-throwing `Try*` interfaces.
+enum class IniErrc {
+  kOk = 0,
+  kMissing,     // the file or the key doesn't exist, or the value is empty.
+  kMalformed,   // the value can't be parsed as the requested type.
+  kOutOfRange,  // the value doesn't fit in the requested type.
+  kIoError,     // the file exists but can't be read.
+  kInvalid,     // the file violates a registered constraint.
+};
+
+/// @brief Return a static description of `errc`, never allocates.
+inline const char* IniErrcMessage(IniErrc errc) {
+  switch (errc) {
+    case IniErrc::kOk:
+      return "ok";
+    case IniErrc::kMissing:
+      return "missing";
+    case IniErrc::kMalformed:
+      return "malformed";
+    case IniErrc::kOutOfRange:
+      return "out of range";
+    case IniErrc::kIoError:
+      return "io error";
+    case IniErrc::kInvalid:
+      return "invalid";
+  }
+  return "unknown";
+}
+
+/// @brief Map the `ValueTraits::Parse` result to an `IniErrc`.
+inline IniErrc ToIniErrc(std::errc ec) {
+  if (ec == std::errc{}) {
+    return IniErrc::kOk;
+  }
+  return ec == std::errc::result_out_of_range ? IniErrc::kOutOfRange
+                                              : IniErrc::kMalformed;
+}
+
+/**
+ * @brief The error of an `IniExpected`, in the spirit of `std::unexpected`:
+ * `return IniUnexpected(IniErrc::kMissing);`. An error is never built from a
+ * value by accident, even when `T` converts from `IniErrc`.
+ */
+struct IniUnexpected {
+  explicit IniUnexpected(IniErrc errc) : error(errc) {}
+  IniErrc error;
+};
+
+/**
+ * @brief Either a `T` or the `IniErrc` explaining why there is none, in the
+ * spirit of `std::expected`. The error state holds no allocation.
+ *
+ * @tparam T The type of the value.
+ */
+template <typename T>
+class IniExpected {
+ public:
+  IniExpected(T value) : value_(std::move(value)) {}  // NOLINT
+  IniExpected(IniUnexpected unexpected)               // NOLINT
+      : error_(unexpected.error) {}
+
+  bool has_value() const { return value_.has_value(); }
+  explicit operator bool() const { return has_value(); }
+  IniErrc error() const { return error_; }
+  const T& value() const& { return value_.value(); }
+  T& value() & { return value_.value(); }
+  T&& value() && { return std::move(value_).value(); }
+  const T& operator*() const& { return *value_; }
+  T& operator*() & { return *value_; }
+  const T* operator->() const { return &*value_; }
+  template <typename U>
+  T value_or(U&& default_value) const& {
+    return value_.value_or(std::forward<U>(default_value));
+  }
+
+ private:
+  std::optional<T> value_;
+  IniErrc error_ = IniErrc::kOk;
+};
+
+/**
+ * @brief Non-throwing `ConvertValue`: parse `value` as a `T`.
+ *
+ * @tparam T The expected type of the value.
+ * @param value The value read from the `ini` file.
+ * @return IniExpected<T> kMissing if `value` is empty.
+ */
+template <typename T, enable_if_supported_type<T> = 0>
+IniExpected<T> TryConvertValue(std::string_view value) {
+  if (value.empty()) {
+    return IniUnexpected(IniErrc::kMissing);
+  }
+  T result{};
+  auto errc = ToIniErrc(ValueTraits<T>::Parse(value, result));
+  if (errc != IniErrc::kOk) {
+    return IniUnexpected(errc);
+  }
+  return result;
+}
+
+/**
+ * @brief Return the value by the type of `T`. if the value is empty, return the
+ * `default_value`
+ *
+ * @tparam T The expected type of the value.
+ * @param value The value read from the `ini` file.
+ * @param default_value The default value.
+ * @return T
+ * @throw std::invalid_argument if `value` is malformed, std::out_of_range if
+ * it doesn't fit in `T`.
+ */
+template <typename T, enable_if_supported_type<T> = 0>
+T ConvertValue(std::string_view value, const T& default_value) {
+  if (value.empty()) {
+    return default_value;
+  }
+  T result{};
+  auto ec = ValueTraits<T>::Parse(value, result);
+  if (ec == std::errc::result_out_of_range) {
+    INI_THROW(std::out_of_range("ConvertValue: out of range: " +
+                                std::string(value)));
+  }
+  if (ec != std::errc{}) {
+    INI_THROW(std::invalid_argument("ConvertValue: malformed value: " +
+                                    std::string(value)));
+  }
+  return result;
+}
+
+// a lookup table of the ASCII whitespaces: space, \t, \n, \v, \f and \r.
+struct AsciiSpaceTable {
+  bool is_space[256] = {};
+  constexpr AsciiSpaceTable() {
+    for (char ch : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+      is_space[static_cast<unsigned char>(ch)] = true;
+    }
+  }
+};
+inline constexpr AsciiSpaceTable kAsciiSpaceTable;
+
+/// @brief Whether `ch` is an ASCII whitespace, without a branch.
+inline bool IsAsciiSpace(char ch) {
+  return kAsciiSpaceTable.is_space[static_cast<unsigned char>(ch)];
+}
+
+/**
+ * @brief Trim the ASCII whitespaces of `s`, without a copy: the result views
+ * `s`. Use the overload with a locale for other whitespaces.
+ */
+inline std::string_view Trim(std::string_view s) {
+  std::size_t first = 0;
+  std::size_t last = s.size();
+  while (first < last && IsAsciiSpace(s[first])) {
+    ++first;
+  }
+  while (last > first && IsAsciiSpace(s[last - 1])) {
+    --last;
+  }
+  return s.substr(first, last - first);
+}
+// the result would view a destroyed string.
+std::string_view Trim(std::string&& s) = delete;
+
+/// @brief Trim the string `s` with the whitespaces of the locale `loc`.
+template <class Str>
+Str Trim(const Str& s, const std::locale& loc) {
+  std::size_t first = 0;
+  std::size_t last = s.size();
+  while (first < last && std::isspace(s[first], loc)) {
+    ++first;
+  }
+  while (last > first && std::isspace(s[last - 1], loc)) {
+    --last;
+  }
+  return s.substr(first, last - first);
+}
+
+/**
+ * @brief A lazy range over the tokens of `str` separated by any character of
+ * `separators`. Empty tokens are skipped, and the tokens view `str`: nothing
+ * is allocated.
+ *
+ *   for (std::string_view token : SplitView("a, b,,c", ", ")) { ... }
+ */
+class SplitView {
+ public:
+  class iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view*;
+    using reference = const std::string_view&;
+
+    iterator() = default;
+    reference operator*() const { return token_; }
+    pointer operator->() const { return &token_; }
+    iterator& operator++() {
+      Next(static_cast<std::size_t>(token_.data() - str_.data()) +
+           token_.size());
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator it = *this;
+      ++*this;
+      return it;
+    }
+    friend bool operator==(const iterator& a, const iterator& b) {
+      return a.token_.data() == b.token_.data();
+    }
+    friend bool operator!=(const iterator& a, const iterator& b) {
+      return !(a == b);
+    }
+
+   private:
+    friend class SplitView;
+    iterator(std::string_view str, std::string_view separators)
+        : str_(str), separators_(separators) {
+      Next(0);
+    }
+    void Next(std::size_t from) {
+      // a single separator, e.g. the `.` of the keys, is a plain `find`.
+      std::size_t start;
+      std::size_t end;
+      if (separators_.size() == 1) {
+        start = from;
+        while (start < str_.size() && str_[start] == separators_[0]) {
+          ++start;
+        }
+        end = str_.find(separators_[0], start);
+      } else {
+        start = str_.find_first_not_of(separators_, from);
+        end = str_.find_first_of(separators_, start);
+      }
+      if (start >= str_.size()) {
+        token_ = {};
+        return;
+      }
+      token_ = str_.substr(start, std::min(end, str_.size()) - start);
+    }
+
+    std::string_view str_;
+    std::string_view separators_;
+    // a null data() marks the end.
+    std::string_view token_;
+  };
+
+  SplitView(std::string_view str, std::string_view separators)
+      : str_(str), separators_(separators) {}
+  iterator begin() const { return iterator(str_, separators_); }
+  iterator end() const { return iterator(); }
+
+ private:
+  std::string_view str_;
+  std::string_view separators_;
+};
+
+/**
+ * @brief Split the string `str` with the `pattern`.
+ *
+ * @param str
+ * @param pattern Any of its characters separates the tokens.
+ * @return std::vector<std::string> The non-empty tokens, see `SplitView`.
+ */
+inline std::vector<std::string> Split(const std::string& str,
+                                      const std::string& pattern) {
+  std::vector<std::string> result;
+  for (auto token : SplitView(str, pattern)) {
+    result.emplace_back(token);
+  }
+  return result;
+}
+
+/// @brief A value scanned by `ScanIniValue`.
+struct IniValueToken {
+  std::string_view value;   // views the text, or the buffer if unescaped.
+  std::size_t begin = 0;    // of the value as written, quotes included.
+  std::size_t end = 0;
+  bool continued = false;   // a trailing `\` continues it on the next line.
+  bool unterminated = false;  // a quote without its closing quote.
+};
+
+/**
+ * @brief Scan the value after the `=` of a key line, in one pass:
+ * - an unquoted value ends at a `;` or `#` comment, where `\;` and `\#` stand
+ *   for the characters, and a trailing `\` continues it on the next line;
+ * - a `"..."` value may hold comment characters and the escapes `\"`, `\\`,
+ *   `\n`, `\r` and `\t`.
+ * Values without quotes or escapes, the common case, are not copied.
+ *
+ * @param text The text after the `=`.
+ * @param buffer Holds the value when it had to be unescaped.
+ */
+inline IniValueToken ScanIniValue(std::string_view text, std::string& buffer) {
+  IniValueToken token;
+  std::size_t i = 0;
+  while (i < text.size() && IsAsciiSpace(text[i])) {
+    ++i;
+  }
+  token.begin = i;
+  token.end = i;
+  bool copied = false;
+  if (i < text.size() && text[i] == '"') {
+    std::size_t first = ++i;
+    for (; i < text.size() && text[i] != '"'; ++i) {
+      if (text[i] != '\\' || i + 1 == text.size()) {
+        if (copied) {
+          buffer += text[i];
+        }
+        continue;
+      }
+      if (!copied) {
+        buffer.assign(text.substr(first, i - first));
+        copied = true;
+      }
+      switch (text[++i]) {
+        case 'n':
+          buffer += '\n';
+          break;
+        case 'r':
+          buffer += '\r';
+          break;
+        case 't':
+          buffer += '\t';
+          break;
+        default:
+          buffer += text[i];
+      }
+    }
+    token.unterminated = i == text.size();
+    token.end = token.unterminated ? i : i + 1;
+    token.value = copied ? std::string_view(buffer)
+                         : text.substr(first, i - first);
+    return token;
+  }
+  std::size_t first = i;
+  // the size of `buffer` without its trailing spaces.
+  std::size_t kept = 0;
+  // only a `\` at the end of the text, spaces aside, continues the value.
+  std::size_t last = Trim(text).size() + i;
+  for (; i < text.size(); ++i) {
+    char ch = text[i];
+    if (ch == ';' || ch == '#') {
+      break;
+    }
+    if (ch == '\\') {
+      if (i + 1 < text.size() && (text[i + 1] == ';' || text[i + 1] == '#')) {
+        if (!copied) {
+          buffer.assign(text.substr(first, i - first));
+          copied = true;
+        }
+        buffer += text[++i];
+        kept = buffer.size();
+        token.end = i + 1;
+        continue;
+      }
+      if (i + 1 == last) {
+        // the spaces before the `\` are part of the value.
+        token.continued = true;
+        if (copied) {
+          kept = buffer.size();
+        }
+        token.end = i;
+        break;
+      }
+    }
+    if (copied) {
+      buffer += ch;
+    }
+    if (!IsAsciiSpace(ch)) {
+      token.end = i + 1;
+      kept = copied ? buffer.size() : kept;
+    }
+  }
+  if (copied) {
+    buffer.resize(kept);
+    token.value = buffer;
+  } else {
+    token.value = text.substr(first, token.end - first);
+  }
+  return token;
+}
+
+/// @brief Whether `value` must be quoted to be read back as is.
+inline bool NeedsIniQuotes(std::string_view value) {
+  if (value.empty()) {
+    return false;
+  }
+  if (IsAsciiSpace(value.front()) || IsAsciiSpace(value.back()) ||
+      value.front() == '"' || value.back() == '\\') {
+    return true;
+  }
+  return value.find_first_of(";#\n\r") != std::string_view::npos;
+}
+
+/// @brief Quote `value` with the escapes of `ScanIniValue`.
+inline std::string QuoteIniValue(std::string_view value) {
+  std::string quoted = "\"";
+  for (char ch : value) {
+    switch (ch) {
+      case '"':
+      case '\\':
+        quoted += '\\';
+        quoted += ch;
+        break;
+      case '\n':
+        quoted += "\\n";
+        break;
+      case '\r':
+        quoted += "\\r";
+        break;
+      case '\t':
+        quoted += "\\t";
+        break;
+      default:
+        quoted += ch;
+    }
+  }
+  quoted += '"';
+  return quoted;
+}
+
+/// @brief `value` as written in a file: quoted only if needed.
+inline std::string FormatIniValue(std::string_view value) {
+  return NeedsIniQuotes(value) ? QuoteIniValue(value) : std::string(value);
+}
+
+/**
+ * @brief Match `text` against the glob `pattern`, where `*` matches any run of
+ * characters and `?` matches a single character.
+ */
+inline bool GlobMatch(std::string_view pattern, std::string_view text) {
+  std::size_t p = 0;
+  std::size_t t = 0;
+  std::size_t star = std::string_view::npos;
+  std::size_t star_text = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_text = t;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      t = ++star_text;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+/// @brief What to do with a value that violates a range constraint.
+enum class IniConstraintAction {
+  kReject,  // reject the whole file.
+  kClamp,   // replace the value by the nearest bound.
+};
+
+/**
+ * @brief A check run on a value when a table is loaded, see
+ * `Settings::AddConstraint`. Build it with one of the factories.
+ */
+class IniConstraint {
+ public:
+  using Check = std::function<bool(std::string& value)>;
+  /**
+   * @brief The value, read as a `T`, must be within [min, max].
+   *
+   * @tparam T Any type with `ValueTraits` and `operator<`.
+   * @param action Reject the file, or clamp the value to the range.
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  static IniConstraint Range(T min, T max, IniConstraintAction action =
+                                               IniConstraintAction::kReject) {
+    std::string description = "range [" + ValueTraits<T>::Format(min) + ", " +
+                              ValueTraits<T>::Format(max) + "]";
+    return IniConstraint(
+        std::move(description), [min, max, action](std::string& value) {
+          T parsed{};
+          if (ValueTraits<T>::Parse(value, parsed) != std::errc{}) {
+            return false;
+          }
+          if (!(parsed < min) && !(max < parsed)) {
+            return true;
+          }
+          if (action == IniConstraintAction::kReject) {
+            return false;
+          }
+          value = ValueTraits<T>::Format(parsed < min ? min : max);
+          return true;
+        });
+  }
+  /// @brief The value must be one of `values`.
+  static IniConstraint OneOf(std::vector<std::string> values) {
+    std::string description = "one of {";
+    for (const auto& value : values) {
+      description += (description.back() == '{' ? "" : ", ") + value;
+    }
+    description += "}";
+    return IniConstraint(std::move(description),
+                         [values = std::move(values)](std::string& value) {
+                           for (const auto& allowed : values) {
+                             if (allowed == value) {
+                               return true;
+                             }
+                           }
+                           return false;
+                         });
+  }
+  /// @brief The value must match the glob `pattern`, see `GlobMatch`.
+  static IniConstraint Pattern(std::string pattern) {
+    std::string description = "pattern " + pattern;
+    return IniConstraint(std::move(description),
+                         [pattern = std::move(pattern)](std::string& value) {
+                           return GlobMatch(pattern, value);
+                         });
+  }
+  /// @brief The value must satisfy `predicate`.
+  static IniConstraint Predicate(
+      std::string description,
+      std::function<bool(std::string_view value)> predicate) {
+    return IniConstraint(
+        std::move(description),
+        [predicate = std::move(predicate)](std::string& value) {
+          return predicate(value);
+        });
+  }
+
+  /**
+   * @brief Check `value`, possibly rewriting it (e.g. clamping).
+   *
+   * @return false if `value` violates the constraint.
+   */
+  bool Apply(std::string& value) const { return check_(value); }
+  const std::string& Description() const { return description_; }
+
+ private:
+  IniConstraint(std::string description, Check check)
+      : description_(std::move(description)), check_(std::move(check)) {}
+  std::string description_;
+  Check check_;
+};
+
+/// @brief A value rejected by an `IniConstraint`.
+struct IniViolation {
+  std::string key;
+  std::string value;
+  std::string constraint;
+};
+
+/**
+ * @brief Call `on_ref(name)` for every `${name}` reference in `value`, where
+ * `$$` is an escaped `$`. Unterminated references are ignored.
+ */
+template <typename OnRef>
+void ScanReferences(std::string_view value, OnRef&& on_ref) {
+  for (std::size_t pos = value.find('$'); pos != std::string_view::npos;
+       pos = value.find('$', pos)) {
+    if (pos + 1 < value.size() && value[pos + 1] == '$') {
+      pos += 2;
+      continue;
+    }
+    if (pos + 1 >= value.size() || value[pos + 1] != '{') {
+      ++pos;
+      continue;
+    }
+    auto end = value.find('}', pos + 2);
+    if (end == std::string_view::npos) {
+      return;
+    }
+    on_ref(value.substr(pos + 2, end - pos - 2));
+    pos = end + 1;
+  }
+}
+
+/**
+ * @brief Replace the `${name}` references of `value` by `lookup(name)` and the
+ * `$$` escapes by `$`.
+ */
+template <typename Lookup>
+std::string SubstituteReferences(std::string_view value, Lookup&& lookup) {
+  std::string result;
+  result.reserve(value.size());
+  std::size_t pos = 0;
+  while (pos < value.size()) {
+    auto dollar = value.find('$', pos);
+    if (dollar == std::string_view::npos || dollar + 1 >= value.size()) {
+      break;
+    }
+    result.append(value.substr(pos, dollar - pos));
+    if (value[dollar + 1] == '$') {
+      result += '$';
+      pos = dollar + 2;
+      continue;
+    }
+    auto end = value[dollar + 1] == '{' ? value.find('}', dollar + 2)
+                                        : std::string_view::npos;
+    if (end == std::string_view::npos) {
+      result += '$';
+      pos = dollar + 1;
+      continue;
+    }
+    result.append(lookup(value.substr(dollar + 2, end - dollar - 2)));
+    pos = end + 1;
+  }
+  result.append(value.substr(pos));
+  return result;
+}
+
+/**
+ * @brief Resolve the `${section.key}`, `${key}` (same section) and
+ * `${ENV:NAME}` references of the `raw` table into `resolved`. Keys are
+ * resolved in dependency order; unknown references expand to nothing.
+ *
+ * When the previous generation is given, a key whose raw value is unchanged
+ * and whose dependencies resolved to the same values reuses its previous
+ * resolved value, so only the keys depending on changed keys are recomputed.
+ * Keys referring to environment variables, or to keys that don't exist, are
+ * always recomputed.
+ *
+ * @param raw The table as read from the file.
+ * @param lines The line of each key, used to report cycles. May be empty.
+ * @param prev_raw The previous raw table, or nullptr.
+ * @param prev_resolved The previous resolved table, or nullptr.
+ * @param resolved The resolved table.
+ * @param violations One entry per key in a reference cycle.
+ * @return std::size_t The number of values that were interpolated.
+ */
+inline std::size_t InterpolateTbl(const StrStrMap& raw,
+                                  const IniKeyLines& lines,
+                                  const StrStrMap* prev_raw,
+                                  const IniPersistentMap* prev_resolved,
+                                  StrStrMap& resolved,
+                                  std::vector<IniViolation>& violations) {
+  constexpr std::string_view kEnvPrefix = "ENV:";
+  constexpr std::size_t kNoKey = std::numeric_limits<std::size_t>::max();
+  struct Node {
+    const SharedStr* key;
+    const SharedStr* raw;
+    std::vector<std::size_t> deps;
+    bool has_ref = false;
+    bool has_env = false;
+    // a reference to no key, or to another key than in `prev_raw`.
+    bool has_moved_ref = false;
+  };
+  std::vector<Node> nodes;
+  nodes.reserve(raw.size());
+  std::unordered_map<std::string_view, std::size_t> index;
+  index.reserve(raw.size());
+  for (const auto& [key, value] : raw) {
+    index.emplace(key, nodes.size());
+    nodes.push_back({&key, &value, {}, false, false, false});
+  }
+  // `${name}` is an absolute key, or a key of the same section.
+  auto find_ref = [&](const Node& node, std::string_view name) {
+    auto it = index.find(name);
+    if (it != index.end()) {
+      return it->second;
+    }
+    auto key = node.key->view();
+    std::string local(key.substr(0, key.find('.') + 1));
+    local += name;
+    it = index.find(local);
+    return it == index.end() ? kNoKey : it->second;
+  };
+  for (auto& node : nodes) {
+    ScanReferences(*node.raw, [&](std::string_view name) {
+      node.has_ref = true;
+      if (name.substr(0, kEnvPrefix.size()) == kEnvPrefix) {
+        node.has_env = true;
+        return;
+      }
+      auto dep = find_ref(node, name);
+      if (dep == kNoKey) {
+        // it may have resolved before, and `deps` can't tell.
+        node.has_moved_ref = true;
+        return;
+      }
+      node.deps.push_back(dep);
+      // a key of the same section, where an absolute key was found before.
+      if (prev_raw && index.find(name) == index.end() &&
+          prev_raw->find(name) != prev_raw->end()) {
+        node.has_moved_ref = true;
+      }
+    });
+  }
+
+  // topological order by an iterative depth-first search.
+  enum class Mark : std::uint8_t { kNew, kVisiting, kDone };
+  std::vector<Mark> marks(nodes.size(), Mark::kNew);
+  std::vector<bool> in_cycle(nodes.size(), false);
+  std::vector<std::size_t> order;
+  order.reserve(nodes.size());
+  std::vector<std::pair<std::size_t, std::size_t>> stack;
+  auto describe = [&](std::size_t i) {
+    std::string text = nodes[i].key->str();
+    auto line = lines.find(text);
+    if (line != lines.end()) {
+      text += " (line " + std::to_string(line->second) + ")";
+    }
+    return text;
+  };
+  for (std::size_t root = 0; root < nodes.size(); ++root) {
+    if (marks[root] != Mark::kNew) {
+      continue;
+    }
+    marks[root] = Mark::kVisiting;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      auto& [current, next] = stack.back();
+      if (next == nodes[current].deps.size()) {
+        marks[current] = Mark::kDone;
+        order.push_back(current);
+        stack.pop_back();
+        continue;
+      }
+      auto dep = nodes[current].deps[next++];
+      if (marks[dep] == Mark::kNew) {
+        marks[dep] = Mark::kVisiting;
+        stack.emplace_back(dep, 0);
+      } else if (marks[dep] == Mark::kVisiting && !in_cycle[dep]) {
+        // the cycle is the part of the stack from `dep` to the top.
+        std::size_t from = stack.size();
+        while (stack[from - 1].first != dep) {
+          --from;
+        }
+        std::string chain;
+        for (std::size_t i = from - 1; i < stack.size(); ++i) {
+          chain += describe(stack[i].first) + " -> ";
+        }
+        chain += describe(dep);
+        for (std::size_t i = from - 1; i < stack.size(); ++i) {
+          in_cycle[stack[i].first] = true;
+          violations.push_back({nodes[stack[i].first].key->str(),
+                                nodes[stack[i].first].raw->str(),
+                                "interpolation cycle: " + chain});
+        }
+      }
+    }
+  }
+
+  // resolve dependencies first, reusing the previous values when possible.
+  std::vector<SharedStr> values(nodes.size());
+  std::vector<bool> changed(nodes.size(), true);
+  std::size_t interpolated = 0;
+  for (auto i : order) {
+    const auto& node = nodes[i];
+    const SharedStr* prev_value = nullptr;
+    if (prev_resolved) {
+      prev_value = prev_resolved->Find(*node.key);
+    }
+    bool same_raw = false;
+    if (prev_raw) {
+      auto it = prev_raw->find(*node.key);
+      same_raw = it != prev_raw->end() && it->second == *node.raw;
+    }
+    bool deps_changed = false;
+    for (auto dep : node.deps) {
+      deps_changed = deps_changed || changed[dep];
+    }
+    if (!node.has_ref || in_cycle[i]) {
+      values[i] = *node.raw;
+    } else if (prev_value && same_raw && !deps_changed && !node.has_env &&
+               !node.has_moved_ref) {
+      values[i] = *prev_value;
+    } else {
+      values[i] = SubstituteReferences(*node.raw, [&](std::string_view name) {
+        if (name.substr(0, kEnvPrefix.size()) == kEnvPrefix) {
+          const char* env =
+              std::getenv(std::string(name.substr(kEnvPrefix.size())).c_str());
+          return std::string_view(env ? env : "");
+        }
+        auto dep = find_ref(node, name);
+        return dep == kNoKey ? std::string_view() : values[dep].view();
+      });
+      ++interpolated;
+    }
+    changed[i] = !prev_value || *prev_value != values[i];
+  }
+  resolved.clear();
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    resolved.emplace_hint(resolved.end(), *nodes[i].key, std::move(values[i]));
+  }
+  return interpolated;
+}
+
+/**
+ * @brief Flatten the `[child : parent]` sections of `tbl`: every key of the
+ * parent section that the child doesn't define is copied to the child,
+ * parents first so inheritance chains work. The copies share the values of
+ * the parent, and a child key is then an ordinary key of the table.
+ *
+ * @param tbl The table to flatten in place.
+ * @param parents The parent of each inheriting section.
+ * @param violations Receives one entry per section in an inheritance cycle.
+ * @return false if a cycle was found.
+ */
+inline bool InheritSections(StrStrMap& tbl, const IniSectionParents& parents,
+                            std::vector<IniViolation>& violations) {
+  std::set<std::string> done;
+  auto count = violations.size();
+  for (const auto& [section, ignored] : parents) {
+    // walk up to the first flattened ancestor, then flatten back down.
+    std::vector<std::string> chain = {section};
+    bool cycle = false;
+    while (done.find(chain.back()) == done.end()) {
+      auto parent = parents.find(chain.back());
+      if (parent == parents.end()) {
+        break;
+      }
+      if (std::find(chain.begin(), chain.end(), parent->second) !=
+          chain.end()) {
+        cycle = true;
+        break;
+      }
+      chain.push_back(parent->second);
+    }
+    if (cycle) {
+      std::string text;
+      for (const auto& name : chain) {
+        text += name + " -> ";
+      }
+      text += parents.at(chain.back());
+      for (const auto& name : chain) {
+        if (done.insert(name).second) {
+          violations.push_back({name, "", "inheritance cycle: " + text});
+        }
+      }
+      continue;
+    }
+    for (auto child = chain.rbegin() + 1; child < chain.rend(); ++child) {
+      if (!done.insert(*child).second) {
+        continue;
+      }
+      std::string parent_prefix = *(child - 1) + ".";
+      std::string child_prefix = *child + ".";
+      // collected first: `[a.b : a]` inserts into the range it reads.
+      std::vector<std::pair<std::string, SharedStr>> inherited;
+      for (auto it = tbl.lower_bound(parent_prefix);
+           it != tbl.end() && it->first.view().compare(
+                                  0, parent_prefix.size(), parent_prefix) == 0;
+           ++it) {
+        inherited.emplace_back(
+            child_prefix +
+                std::string(it->first.view().substr(parent_prefix.size())),
+            it->second);
+      }
+      for (auto& [key, value] : inherited) {
+        tbl.emplace(key, std::move(value));
+      }
+    }
+    done.insert(section);
+  }
+  return violations.size() == count;
+}
+
+/**
+ * @brief Lower-case the ASCII letters of the keys of `tbl` and of the section
+ * names of `parents`, for the case-insensitive lookups. Only the nodes of the
+ * keys with capitals are re-keyed. When keys differ only by case, a key
+ * already in lower case is kept, else the first one in the table order.
+ */
+inline void FoldIniKeys(StrStrMap& tbl, IniSectionParents& parents) {
+  auto has_upper = [](std::string_view text) {
+    return std::any_of(text.begin(), text.end(),
+                       [](char ch) { return ch >= 'A' && ch <= 'Z'; });
+  };
+  std::vector<StrStrMap::node_type> folded;
+  for (auto it = tbl.begin(); it != tbl.end();) {
+    if (!has_upper(it->first.view())) {
+      ++it;
+      continue;
+    }
+    auto node = tbl.extract(it++);
+    node.key() = IniStringPool::Instance().Intern(
+        FoldAsciiCase(node.key().view()));
+    folded.push_back(std::move(node));
+  }
+  for (auto& node : folded) {
+    tbl.insert(std::move(node));
+  }
+  IniSectionParents folded_parents;
+  for (const auto& [child, parent] : parents) {
+    folded_parents.emplace(FoldAsciiCase(child), FoldAsciiCase(parent));
+  }
+  parents.swap(folded_parents);
+}
+
+/// @brief A range of bytes `[begin, end)` of a file.
+struct IniByteRange {
+  std::size_t begin = 0;
+  std::size_t end = 0;
+};
+// the ranges of each section of a file, from its header to the next header.
+using IniSectionIndex =
+    std::map<std::string, std::vector<IniByteRange>, std::less<>>;
+
+/**
+ * @brief Record the byte ranges of the sections of `content` without parsing
+ * their keys. A range starts at the header line, so `ReadIni` can parse it on
+ * its own, and a section written several times has several ranges.
+ *
+ * @param content The content of the file.
+ * @param index Receives the ranges of each section.
+ * @return false if the file has `@include` directives or inheriting sections,
+ * which need the whole file to be read.
+ */
+inline bool IndexIniSections(std::string_view content,
+                             IniSectionIndex& index) {
+  constexpr std::string_view kIncludeDirective = "@include ";
+  std::vector<IniByteRange>* current = nullptr;
+  // the lines are classified like `ReadIni` does: the lines continuing a value
+  // are part of it, even when they start with `[`.
+  bool in_section = false;
+  bool continued = false;
+  std::string buffer;
+  std::size_t pos = Utf8BomSize(content);
+  while (pos < content.size()) {
+    auto eol = content.find('\n', pos);
+    if (eol == std::string_view::npos) {
+      eol = content.size();
+    }
+    auto begin = pos;
+    auto line = content.substr(begin, eol - begin);
+    auto text = Trim(line);
+    pos = eol + 1;
+    if (continued) {
+      continued = ScanIniValue(line, buffer).continued;
+      continue;
+    }
+    if (text.empty() || text[0] == ';' || text[0] == '#') {
+      continue;
+    }
+    if (text.compare(0, kIncludeDirective.size(), kIncludeDirective) == 0) {
+      return false;
+    }
+    if (text[0] == '[') {
+      auto close = text.find(']');
+      if (close == std::string_view::npos) {
+        continue;
+      }
+      std::string name(Trim(text.substr(1, close - 1)));
+      if (name.find(':') != std::string::npos) {
+        return false;
+      }
+      if (current) {
+        current->back().end = begin;
+      }
+      current = &index[name];
+      current->push_back({begin, content.size()});
+      in_section = !name.empty();
+    } else if (in_section) {
+      auto eq = text.find('=');
+      if (eq != std::string_view::npos && eq != 0) {
+        continued = ScanIniValue(text.substr(eq + 1), buffer).continued;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief The read-only content of a file, mapped in memory where `mmap` is
+ * available and read into a buffer otherwise. Mapped pages are loaded on
+ * access and can be dropped by the system under memory pressure.
+ *
+ */
+class IniMappedFile {
+ public:
+  IniMappedFile() = default;
+  explicit IniMappedFile(const char* path) {
+#ifdef INI_HAS_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) == 0) {
+      size_ = static_cast<std::size_t>(st.st_size);
+      open_ = true;
+      if (size_ > 0) {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+          size_ = 0;
+          open_ = false;
+        } else {
+          data_ = static_cast<const char*>(data);
+        }
+      }
+    }
+    ::close(fd);
+#else
+    std::ifstream stream(path, std::ios_base::in | std::ios_base::binary);
+    if (stream) {
+      buffer_.assign(std::istreambuf_iterator<char>(stream),
+                     std::istreambuf_iterator<char>());
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+      open_ = true;
+    }
+#endif
+  }
+  IniMappedFile(const IniMappedFile&) = delete;
+  IniMappedFile& operator=(const IniMappedFile&) = delete;
+  IniMappedFile(IniMappedFile&& other) noexcept { swap(other); }
+  IniMappedFile& operator=(IniMappedFile&& other) noexcept {
+    IniMappedFile moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+  ~IniMappedFile() {
+#ifdef INI_HAS_MMAP
+    if (data_) {
+      ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+  }
+
+  bool is_open() const { return open_; }
+  std::string_view view() const { return {data_ ? data_ : "", size_}; }
+  void swap(IniMappedFile& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(open_, other.open_);
+#ifndef INI_HAS_MMAP
+    buffer_.swap(other.buffer_);
+    data_ = buffer_.data();
+    other.data_ = other.buffer_.data();
+#endif
+  }
+
+ private:
+  const char* data_ = nullptr;
+  std::size_t size_ = 0;
+  bool open_ = false;
+#ifndef INI_HAS_MMAP
+  std::string buffer_;
+#endif
+};
+
+/**
+ * @brief The lines of an `ini` file as written, comments, blank lines and
+ * order included, for edits that change as little as possible of the file.
+ * Lines are byte spans into the original content; only the edited and added
+ * lines are stored on their own.
+ *
+ */
+class IniDocument {
+ public:
+  IniDocument() = default;
+  explicit IniDocument(std::string content) : content_(std::move(content)) {
+    std::size_t pos = 0;
+    bool continued = false;
+    std::string buffer;
+    while (pos < content_.size()) {
+      auto eol = content_.find('\n', pos);
+      if (eol == std::string::npos) {
+        eol = content_.size();
+      }
+      Line line;
+      line.span = {pos, eol};
+      auto text = std::string_view(content_).substr(pos, eol - pos);
+      if (continued) {
+        line.kind = LineKind::kContinuation;
+        continued = ScanIniValue(text, buffer).continued;
+      } else {
+        Classify(text, pos == 0 ? Utf8BomSize(text) : 0, line);
+        continued = line.continued;
+      }
+      lines_.push_back(line);
+      pos = eol + 1;
+    }
+    final_newline_ = content_.empty() || content_.back() == '\n';
+  }
+
+  /**
+   * @brief Set the value of the combined key `section.key`, quoted if needed.
+   * The value of the last line of the key is replaced, keeping its spacing
+   * and comment; a new key is added after the last key of its section, and a
+   * new section at the end of the document.
+   */
+  void SetValue(std::string_view key, std::string_view raw_value) {
+    auto value = FormatIniValue(raw_value);
+    std::string_view section;
+    std::size_t section_size = 0;
+    std::size_t insert_after = kNone;
+    std::size_t found = kNone;
+    for (std::size_t i = 0; i < lines_.size(); ++i) {
+      const auto& line = lines_[i];
+      if (line.kind == LineKind::kSection) {
+        section = Slice(Text(line), line.name);
+      } else if (line.kind != LineKind::kKey) {
+        continue;
+      }
+      // the longest section name wins, `a.b` + `c` over `a` + `b.c`.
+      if (!IsSectionOf(section, key) || section.size() < section_size) {
+        continue;
+      }
+      section_size = section.size();
+      insert_after = i;
+      if (line.kind == LineKind::kKey &&
+          Slice(Text(line), line.name) == key.substr(section.size() + 1)) {
+        found = i;
+      }
+    }
+    if (found != kNone) {
+      auto& line = lines_[found];
+      auto text = Text(line);
+      std::string edited(text.substr(0, line.value.begin));
+      edited += value;
+      if (line.continued) {
+        // the value is on one line now.
+        auto next = lines_.begin() + static_cast<std::ptrdiff_t>(found) + 1;
+        auto last = next;
+        while (last != lines_.end() && last->kind == LineKind::kContinuation) {
+          ++last;
+        }
+        lines_.erase(next, last);
+      } else {
+        edited += text.substr(line.value.end);
+      }
+      Edit(lines_[found], std::move(edited));
+      return;
+    }
+    if (insert_after == kNone) {
+      // a new section, named by the first token like `WriteIni`.
+      auto dot = key.find('.');
+      if (dot == std::string_view::npos) {
+        return;
+      }
+      if (!lines_.empty() && !Trim(Text(lines_.back())).empty()) {
+        Insert(lines_.size(), "");
+      }
+      Insert(lines_.size(), "[" + std::string(key.substr(0, dot)) + "]");
+      Insert(lines_.size(),
+             std::string(key.substr(dot + 1)) + "=" + std::string(value));
+      return;
+    }
+    // the same spacing around `=` as the key before, if any.
+    const auto& previous = lines_[insert_after];
+    std::string added(key.substr(section_size + 1));
+    if (previous.kind == LineKind::kKey) {
+      added += Slice(Text(previous), {previous.name.end, previous.value.begin});
+    } else {
+      added += "=";
+    }
+    added += value;
+    // after the continuation lines of the key before, if it has some.
+    auto at = insert_after + 1;
+    while (at < lines_.size() && lines_[at].kind == LineKind::kContinuation) {
+      ++at;
+    }
+    Insert(at, std::move(added));
+  }
+
+  /// @brief Write the document, unchanged lines byte for byte.
+  void Write(std::ostream& stream) const {
+    for (std::size_t i = 0; i < lines_.size(); ++i) {
+      stream << Text(lines_[i]);
+      if (i + 1 < lines_.size() || final_newline_) {
+        stream << '\n';
+      }
+    }
+  }
+  std::string str() const {
+    std::ostringstream stream;
+    Write(stream);
+    return stream.str();
+  }
+  std::size_t LineCount() const { return lines_.size(); }
+
+ private:
+  static constexpr std::size_t kNone = std::numeric_limits<std::size_t>::max();
+  enum class LineKind : std::uint8_t { kOther, kSection, kKey, kContinuation };
+  struct Line {
+    IniByteRange span;  // of `content_`, unless edited.
+    // relative to the start of the line.
+    IniByteRange name;
+    IniByteRange value;
+    std::uint32_t edit = kNoEdit;  // the index of the text in `edits_`.
+    LineKind kind = LineKind::kOther;
+    bool continued = false;  // the value goes on in the next lines.
+  };
+  static constexpr std::uint32_t kNoEdit =
+      std::numeric_limits<std::uint32_t>::max();
+
+  static std::string_view Slice(std::string_view text, IniByteRange range) {
+    return text.substr(range.begin, range.end - range.begin);
+  }
+  static bool IsSectionOf(std::string_view section, std::string_view key) {
+    return !section.empty() && key.size() > section.size() + 1 &&
+           key[section.size()] == '.' &&
+           key.compare(0, section.size(), section) == 0;
+  }
+  // the same rules as `ReadIni`: a header names the section before any `:`,
+  // and a key line has a name before `=` and a value up to a comment. The
+  // first `skip` bytes, a byte order mark, are kept but not read.
+  static void Classify(std::string_view text, std::size_t skip, Line& line) {
+    auto trimmed = Trim(text.substr(skip));
+    if (trimmed.empty() || trimmed[0] == ';' || trimmed[0] == '#' ||
+        trimmed[0] == '@') {
+      return;
+    }
+    auto offset = [&](std::string_view part) {
+      return static_cast<std::size_t>(part.data() - text.data());
+    };
+    if (trimmed[0] == '[') {
+      auto end = trimmed.find(']');
+      if (end == std::string_view::npos) {
+        return;
+      }
+      auto name = trimmed.substr(1, end - 1);
+      name = Trim(name.substr(0, name.find(':')));
+      line.kind = LineKind::kSection;
+      line.name = {offset(name), offset(name) + name.size()};
+      return;
+    }
+    auto eq = trimmed.find('=');
+    if (eq == std::string_view::npos || eq == 0) {
+      return;
+    }
+    auto name = Trim(trimmed.substr(0, eq));
+    auto rest = trimmed.substr(eq + 1);
+    std::string buffer;
+    auto token = ScanIniValue(rest, buffer);
+    line.kind = LineKind::kKey;
+    line.name = {offset(name), offset(name) + name.size()};
+    line.value = {offset(rest) + token.begin, offset(rest) + token.end};
+    line.continued = token.continued;
+  }
+  std::string_view Text(const Line& line) const {
+    if (line.edit != kNoEdit) {
+      return edits_[line.edit];
+    }
+    return std::string_view(content_).substr(line.span.begin,
+                                             line.span.end - line.span.begin);
+  }
+  void Edit(Line& line, std::string text) {
+    if (line.edit == kNoEdit) {
+      line.edit = static_cast<std::uint32_t>(edits_.size());
+      edits_.emplace_back();
+    }
+    edits_[line.edit] = std::move(text);
+    Classify(edits_[line.edit], 0, line);
+  }
+  void Insert(std::size_t index, std::string text) {
+    Line line;
+    line.edit = static_cast<std::uint32_t>(edits_.size());
+    edits_.push_back(std::move(text));
+    Classify(edits_[line.edit], 0, line);
+    lines_.insert(lines_.begin() + static_cast<std::ptrdiff_t>(index), line);
+    if (index == lines_.size() - 1) {
+      final_newline_ = true;
+    }
+  }
+
+  std::string content_;
+  std::vector<Line> lines_;
+  // the text of the edited and added lines.
+  std::vector<std::string> edits_;
+  bool final_newline_ = true;
+};
+
+/**
+ * @brief Memoizes values derived from a key/value table, e.g. typed lists,
+ * keyed by the derived type and a string key. The owner clears it whenever
+ * the table changes, so each entry is computed once per table generation.
+ * Not thread-safe by itself, the owner provides the locking.
+ */
+class DerivedValueCache {
+ public:
+  /**
+   * @brief Return the cached `V` for `key`, creating it with `make` on a miss.
+   *
+   * @tparam V The type of the derived value.
+   * @param key The cache key.
+   * @param make Callable returning a `V`; if it throws nothing is cached.
+   * @return std::shared_ptr<const V>
+   */
+  template <typename V, typename Make>
+  std::shared_ptr<const V> GetOrCreate(const std::string& key, Make&& make) {
+    auto slot = std::make_pair(std::type_index(typeid(V)), key);
+    auto it = entries_.find(slot);
+    if (it != entries_.end()) {
+      return std::static_pointer_cast<const V>(it->second);
+    }
+    auto value = std::make_shared<const V>(make());
+    entries_.emplace(std::move(slot), value);
+    return value;
+  }
+  void Clear() { entries_.clear(); }
+  std::size_t Size() const { return entries_.size(); }
+
+ private:
+  std::map<std::pair<std::type_index, std::string>, std::shared_ptr<const void>>
+      entries_;
+};
+
+template <typename Tbl>
+static inline void WriteIni(std::basic_ostream<char>& stream,
+                            const Tbl& ini_content_tbl,
+                            const IniSectionParents& parents = {});
+static inline bool ReadIni(std::basic_istream<char>& stream,
+                           StrStrMap& ini_content_tbl,
+                           const IniReadContext& context = {});
+
+/**
+ * @brief `std::getline` that reads at most `max_bytes` bytes of the line.
+ *
+ * @return false if the line is longer, then the stream is left past the
+ * `max_bytes + 1` bytes read.
+ */
+inline bool GetIniLine(std::basic_istream<char>& stream, std::string& line,
+                       std::size_t max_bytes) {
+  using Traits = std::char_traits<char>;
+  if (max_bytes == std::numeric_limits<std::size_t>::max()) {
+    std::getline(stream, line);
+    return true;
+  }
+  line.clear();
+  std::basic_istream<char>::sentry sentry(stream, true);
+  if (!sentry) {
+    return true;
+  }
+  auto* buffer = stream.rdbuf();
+  for (;;) {
+    auto ch = buffer->sbumpc();
+    if (Traits::eq_int_type(ch, Traits::eof())) {
+      stream.setstate(line.empty()
+                          ? std::ios_base::eofbit | std::ios_base::failbit
+                          : std::ios_base::eofbit);
+      return true;
+    }
+    if (Traits::to_char_type(ch) == '\n') {
+      return true;
+    }
+    if (line.size() == max_bytes) {
+      return false;
+    }
+    line.push_back(Traits::to_char_type(ch));
+  }
+}
+
+/**
+ * @brief Replace the file at `path` with what `write(stream)` writes. It is
+ * written to a temporary file next to it, then renamed over it: a reader,
+ * e.g. a reload parsing without the lock, sees the old file or the new one,
+ * never a part of it. The file keeps its permissions.
+ *
+ * @return false if the temporary file can't be written or renamed, then the
+ * file is unchanged.
+ */
+template <typename Write>
+bool ReplaceIniFile(const std::string& path, Write&& write) {
+  std::string temp_path = path + ".tmp";
+  {
+    std::basic_ofstream<char> stream(temp_path);
+    if (!stream) {
+      return false;
+    }
+    stream.imbue(std::locale());
+    write(stream);
+    stream.close();
+    if (!stream) {
+      std::error_code ignored;
+      std_fs::remove(temp_path, ignored);
+      return false;
+    }
+  }
+  std::error_code ec;
+  auto status = std_fs::status(path, ec);
+  if (!ec) {
+    std_fs::permissions(temp_path, status.permissions(), ec);
+  }
+  std_fs::rename(temp_path, path, ec);
+  if (ec) {
+    std::error_code ignored;
+    std_fs::remove(temp_path, ignored);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Process-wide cache of the files pulled in by `@include` directives,
+ * shared by all the `Settings`. A file is parsed once and parsed again only
+ * when its content changes: a changed modification time or size leads to a
+ * re-read, and the parsed table is kept if the content hash is the same.
+ *
+ * Keys of the including file take precedence over the included ones, and
+ * later includes over earlier ones.
+ */
+class IniIncludeCache {
+ public:
+  /// @brief A file a table was built from, and its modification time.
+  struct Stamp {
+    std::string path;
+    std_fs::file_time_type write_time;
+  };
+
+  static IniIncludeCache& Instance() {
+    static IniIncludeCache cache;
+    return cache;
+  }
+
+  /**
+   * @brief Merge the tables of `includes` into `tbl`, recursively.
+   *
+   * @param from The including file; the includes are relative to its folder.
+   * @param includes The directives of `from`.
+   * @param tbl The table to merge into.
+   * @param parents The section parents to merge into.
+   * @param stamps Receives every file merged.
+   * @param violations Receives the include cycles and unreadable files.
+   * @return false if a violation was found.
+   */
+  bool Merge(const std::string& from, const std::vector<IniInclude>& includes,
+             StrStrMap& tbl, IniSectionParents& parents,
+             std::vector<Stamp>& stamps,
+             std::vector<IniViolation>& violations) {
+    std::vector<std::pair<std::string, std::size_t>> chain = {{from, 0}};
+    auto count = violations.size();
+    MergeIncludes(chain, includes, tbl, parents, stamps, violations);
+    return violations.size() == count;
+  }
+  /// @brief The number of files parsed so far.
+  std::size_t ParseCount() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return parse_count_;
+  }
+
+ private:
+  struct File {
+    StrStrMap tbl;
+    std::vector<IniInclude> includes;
+    IniSectionParents parents;
+  };
+  struct Entry {
+    std_fs::file_time_type write_time;
+    std::uintmax_t size = 0;
+    std::uint64_t hash = 0;
+    std::shared_ptr<const File> file;
+  };
+
+  IniIncludeCache() = default;
+
+  // return the parsed `path`, or null if it can't be read. The file is read
+  // and parsed without the lock, so loads of other files don't wait on it.
+  std::shared_ptr<const File> Get(const std::string& path,
+                                  std_fs::file_time_type& write_time) {
+    std::error_code ec;
+    write_time = std_fs::last_write_time(path, ec);
+    auto size = ec ? 0 : std_fs::file_size(path, ec);
+    if (ec) {
+      return nullptr;
+    }
+    auto is_current = [&](const Entry& entry) {
+      return entry.file && entry.write_time == write_time && entry.size == size;
+    };
+    Entry cached;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = files_.find(path);
+      if (it != files_.end()) {
+        if (is_current(it->second)) {
+          return it->second.file;
+        }
+        cached = it->second;
+      }
+    }
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream) {
+      return nullptr;
+    }
+    std::string content((std::istreambuf_iterator<char>(stream)),
+                        std::istreambuf_iterator<char>());
+    auto hash = HashBytes(content);
+    std::shared_ptr<const File> parsed;
+    if (!cached.file || cached.hash != hash) {
+      auto file = std::make_shared<File>();
+      std::istringstream content_stream(content);
+      ReadIni(content_stream, file->tbl,
+              {nullptr, &file->includes, &file->parents,
+               &IniStringPool::Instance()});
+      parsed = std::move(file);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (parsed) {
+      ++parse_count_;
+    }
+    auto& entry = files_[path];
+    // another load may have stored this version meanwhile.
+    if (is_current(entry)) {
+      return entry.file;
+    }
+    entry.write_time = write_time;
+    entry.size = size;
+    if (parsed) {
+      entry.hash = hash;
+      entry.file = std::move(parsed);
+    } else {
+      entry.hash = cached.hash;
+      entry.file = std::move(cached.file);
+    }
+    return entry.file;
+  }
+
+  void MergeIncludes(std::vector<std::pair<std::string, std::size_t>>& chain,
+                     const std::vector<IniInclude>& includes, StrStrMap& tbl,
+                     IniSectionParents& parents, std::vector<Stamp>& stamps,
+                     std::vector<IniViolation>& violations) {
+    auto folder = std_fs::path(chain.back().first).parent_path();
+    for (const auto& include : includes) {
+      auto path = (folder / include.path).lexically_normal().string();
+      chain.back().second = include.line;
+      bool cycle = false;
+      for (const auto& [included, line] : chain) {
+        cycle = cycle || included == path;
+      }
+      if (cycle) {
+        std::string text;
+        for (const auto& [included, line] : chain) {
+          text += included + " (line " + std::to_string(line) + ") -> ";
+        }
+        violations.push_back({"@include", include.path,
+                              "include cycle: " + text + path});
+        continue;
+      }
+      std_fs::file_time_type write_time;
+      auto file = Get(path, write_time);
+      if (!file) {
+        violations.push_back({"@include", include.path,
+                              "unreadable file: " + path});
+        continue;
+      }
+      stamps.push_back({path, write_time});
+      chain.emplace_back(path, 0);
+      MergeIncludes(chain, file->includes, tbl, parents, stamps, violations);
+      chain.pop_back();
+      for (const auto& [key, value] : file->tbl) {
+        tbl.insert_or_assign(key, value);
+      }
+      for (const auto& [child, parent] : file->parents) {
+        parents.insert_or_assign(child, parent);
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, Entry> files_;
+  std::size_t parse_count_ = 0;
+};
+
+/// @brief A key-value pair of an `IniEmbeddedTable`.
+struct IniEmbeddedEntry {
+  std::string_view key;
+  std::string_view value;
+};
+
+/**
+ * @brief A read-only table compiled into the binary, as generated from an ini
+ * file by the `ini_embed` CMake function: the entries are sorted by key, and
+ * reading it costs no parse. See `Settings::SetBaseLayer`.
+ */
+struct IniEmbeddedTable {
+  const IniEmbeddedEntry* entries = nullptr;
+  std::size_t size = 0;
+
+  const IniEmbeddedEntry* begin() const { return entries; }
+  const IniEmbeddedEntry* end() const { return entries + size; }
+  /// @brief Return the entry of `key`, or nullptr.
+  const IniEmbeddedEntry* Find(std::string_view key) const {
+    auto it = std::lower_bound(
+        begin(), end(), key,
+        [](const IniEmbeddedEntry& entry, std::string_view target) {
+          return entry.key < target;
+        });
+    return it != end() && it->key == key ? it : nullptr;
+  }
+};
+
+/// @brief Memory statistics of the lazy sections of a `Settings`.
+struct IniMemoryStats {
+  std::size_t resident_bytes = 0;     // estimated size of the parsed sections.
+  std::size_t resident_sections = 0;  // sections parsed and not evicted.
+  std::size_t pending_sections = 0;   // sections not parsed yet or evicted.
+  std::uint64_t evictions = 0;        // sections evicted to fit the budget.
+};
+
+/// @brief A table published by a `Settings`, see `SetHistory`.
+struct IniVersion {
+  std::uint64_t version = 0;  // the `Generation()` it was published as.
+  std::chrono::system_clock::time_point published;
+  IniSnapshot snapshot;
+};
+
+/**
+ * @brief A class to parse `ini` setting files.
+ *
+ * @param `IniFullPath` The full path of the `ini` file.
+ */
+template <const char* IniFullPath>
+class Settings {
+ public:
+  static Settings& GetInstance() {
+    static Settings* ins = nullptr;
+    if (!ins) {
+      static std::once_flag flag;
+      std::call_once(flag, [&]() { ins = new (std::nothrow) Settings(); });
+    }
+    return *ins;
+  }
+  // Tear down the singleton
+  static void DestroyInstance() {
+    Settings* ins = &GetInstance();
+    if (!ins) {
+      static std::once_flag release_flag;
+      std::call_once(release_flag, [&]() { delete ins; });
+    }
+  }
+  // disable copy and move
+  Settings(Settings const&) = delete;
+  Settings& operator=(Settings const&) = delete;
+  Settings(Settings&&) = delete;
+  Settings& operator=(Settings&&) = delete;
+
+  // ***********  interfaces ***********
+  /**
+   * @brief Return the full path of the `ini` file.
+   *
+   * @return const char*
+   */
+  std::string GetFullPath() const { return IniFullPath; }
+  /**
+   * @brief Get the value of the `key` from the `ini` file. If the `key` doesn't
+   * exist, return the `default_value`.
+   *
+   * @tparam T The type of the value.
+   * @tparam Types The type of the format string.
+   * @param default_value The default value if the `key` doesn't exist.
+   * @param fmt The format string to get the string of the key.
+   * @param args The arguments of the format string.
+   * @return T
+   */
+  template <typename T, typename... Types, enable_if_supported_type<T> = 0>
+  T GetValue2(const T& default_value, const std::string& fmt, Types&&... args);
+  /**
+   * @brief Get the value of the `key` from the `ini` file. If the `key` doesn't
+   * exist, return the `default_value`.
+   *
+   * @tparam T
+   * @param key
+   * @param default_value
+   * @return T
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  T GetValue(const std::string& key, T default_value = T());
+  /**
+   * @brief Non-throwing `GetValue`: get the value of the `key` or the reason
+   * why it can't be read. The error path doesn't allocate.
+   *
+   * @tparam T The type of the value.
+   * @param key The key of the value.
+   * @return IniExpected<T> kMissing if the file or the `key` doesn't exist or
+   * the value is empty, kMalformed/kOutOfRange if it can't be converted and
+   * kIoError if the file can't be read.
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  IniExpected<T> TryGetValue(const std::string& key);
+  /**
+   * @brief Save/change the `value` to the `key` to the `ini` file.
+   *
+   * @tparam T
+   * @param key The key of the value.
+   * @param value The value to be saved.
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  void SetValue(const std::string& key, const T& value);
+  /**
+   * @brief Get the list stored in `key`, e.g. `servers = a:1, b:2, c:3`, split
+   * by any character of `sep` and with each element trimmed and converted to
+   * `T`. The list is parsed once per table generation and shared by all the
+   * readers until the file changes.
+   *
+   * @tparam T The type of the elements.
+   * @param key The key of the list.
+   * @param sep The separator characters.
+   * @return std::shared_ptr<const std::vector<T>> Empty if `key` doesn't exist.
+   * @throw std::invalid_argument/std::out_of_range if an element is malformed.
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  std::shared_ptr<const std::vector<T>> GetList(const std::string& key,
+                                                const std::string& sep = ",");
+  /**
+   * @brief Like `GetValue`, but the converted value is cached per table
+   * generation, so expensive conversions run once until the file changes.
+   *
+   * @tparam T The type of the value.
+   * @param key The key of the value.
+   * @param default_value The default value if the `key` doesn't exist.
+   * @return T
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  T GetCachedValue(const std::string& key, T default_value = T());
+  /**
+   * @brief Get a byte size written with an optional unit, e.g. `64MiB` or
+   * `1.5GB`. The parsed size is cached per table generation.
+   *
+   * @param key The key of the value.
+   * @param default_value The default size in bytes.
+   * @return std::uint64_t The size in bytes.
+   */
+  std::uint64_t GetBytes(const std::string& key,
+                         std::uint64_t default_value = 0) {
+    return GetCachedValue<ByteSize>(key, ByteSize{default_value}).bytes;
+  }
+  /**
+   * @brief Get a duration written with units, e.g. `250ms` or `1h30m`, or as a
+   * plain count of `Duration` ticks. The parsed value is cached per table
+   * generation.
+   *
+   * @tparam Duration The std::chrono::duration to return.
+   * @param key The key of the value.
+   * @param default_value The default duration.
+   * @return Duration
+   */
+  template <typename Duration = std::chrono::milliseconds>
+  Duration GetDuration(const std::string& key,
+                       Duration default_value = Duration()) {
+    return GetCachedValue<Duration>(key, default_value);
+  }
+  // a key resolved by `Register`.
+  using KeyId = std::uint32_t;
+  /**
+   * @brief Resolve `key`, e.g. one defined by a plugin, to a slot read by
+   * `Get`. Registering a key again returns the same id. The slots are bound
+   * again by name when the table changes, so an id stays valid across
+   * reloads and writes.
+   *
+   * @param key The key of the value.
+   * @return KeyId The slot of `key`.
+   */
+  KeyId Register(std::string_view key);
+  /**
+   * @brief Like `GetValue`, but the value is read from the slot of a
+   * registered key, without looking the key up in the table. The slots are
+   * bound once per generation and a value is converted once per slot and
+   * type, so a read takes no lock and doesn't check the file: it sees the
+   * table as of the last read, write or `Refresh` of the instance.
+   *
+   * @tparam T The type of the value.
+   * @param id A slot returned by `Register`.
+   * @param default_value The default value if the key isn't in the table.
+   * @return T
+   */
+  template <typename T, enable_if_supported_type<T> = 0>
+  T Get(KeyId id, T default_value = T());
+  /**
+   * @brief Register a constraint on `key`, checked whenever a new table is
+   * loaded from the file. A file with a rejected value is not published: the
+   * readers keep the previous table and `Violations()` tells why. Takes effect
+   * at the next read.
+   *
+   * @param key The key to check.
+   * @param constraint The check, e.g. `IniConstraint::Range(1, 256)`.
+   */
+  void AddConstraint(const std::string& key, IniConstraint constraint) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    constraints_.emplace(key, std::move(constraint));
+    // validate the current file again at the next read.
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /// @brief Remove all the constraints.
+  void ClearConstraints() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    constraints_.clear();
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /**
+   * @brief Enable the `${section.key}` and `${ENV:NAME}` interpolation of the
+   * values. References are resolved once per table generation, and a file
+   * with a reference cycle is rejected like a constraint violation. The file
+   * keeps the references when values are written. Takes effect at the next
+   * read.
+   */
+  void SetInterpolation(bool enabled) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    interpolation_ = enabled;
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /**
+   * @brief Load only the section index of the file, and parse the keys of a
+   * section the first time one of them is read. Startup then depends on the
+   * number of sections rather than the size of the file. Files with includes
+   * or inheriting sections, and instances with interpolation, constraints or
+   * a base layer, are still loaded at once. Takes effect at the next read.
+   */
+  void SetLazySections(bool enabled) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    lazy_sections_ = enabled;
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /// @brief Return the number of sections not parsed yet.
+  std::size_t PendingSections() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return lazy_index_.size();
+  }
+  /**
+   * @brief Bound the memory of the parsed lazy sections to about `bytes`: the
+   * least recently read sections are evicted, and parsed again from the
+   * mapped file when read. 0, the default, keeps every parsed section.
+   */
+  void SetMemoryBudget(std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    memory_budget_ = bytes;
+    EvictSections({});
+  }
+  /// @brief Return the memory statistics of the lazy sections.
+  IniMemoryStats MemoryStats() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return {resident_bytes_, resident_.size(), lazy_index_.size(),
+            evictions_};
+  }
+  /**
+   * @brief Record up to `limit` diagnostics per load, see `Diagnostics()`, and
+   * pass each recorded one to `sink` when set. The sink runs in the thread
+   * loading the file, possibly under the lock of the instance, and must not
+   * call it. Takes effect at the next load.
+   */
+  void SetDiagnostics(
+      std::size_t limit,
+      std::function<void(const IniDiagnostic&)> sink = nullptr) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    diagnostics_.limit = limit;
+    diagnostics_.sink = std::move(sink);
+  }
+  /// @brief Return the diagnostics of the last load of the file. Lazy
+  /// sections are not checked.
+  IniDiagnostics Diagnostics() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return diagnostics_;
+  }
+  /**
+   * @brief Keep the comments, blank lines and order of the file when values
+   * are written: only the line of the written key changes, and a new key is
+   * added after the last key of its section. Off by default, when the file is
+   * rewritten from the table.
+   */
+  void SetPreserveFormat(bool enabled) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    preserve_format_ = enabled;
+  }
+  /**
+   * @brief Match the section and key names regardless of their ASCII case.
+   * The keys are folded once per load, and a read folds its key in place, so
+   * lookups don't allocate. Written keys keep the case of the file. Lazy
+   * sections are loaded at once in this mode. Takes effect at the next read.
+   */
+  void SetCaseInsensitive(bool enabled) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    case_insensitive_ = enabled;
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /**
+   * @brief Check that the file is well-formed UTF-8 while it is parsed, and
+   * report the first ill-formed sequence in `Diagnostics()`. A leading byte
+   * order mark is always skipped. Takes effect at the next load.
+   */
+  void SetValidateUtf8(bool enabled) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    validate_utf8_ = enabled;
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /**
+   * @brief Bound the parse of the file, for untrusted input. A file past a
+   * bound is rejected like a constraint violation and the previous table is
+   * kept; `Diagnostics()` tells which bound and where. A file with `@include`
+   * directives is rejected too: included files are never read, so a bounded
+   * file can't pull in `/dev/zero` or any other local file. The file is
+   * loaded at once even with lazy sections. Takes effect at the next load.
+   */
+  void SetLimits(const IniLimits& limits) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    limits_ = limits;
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /**
+   * @brief Serve the keys of `table`, e.g. defaults embedded by `ini_embed`,
+   * under the file: the file and its includes override them, and the table
+   * alone is served while the file doesn't exist. The file only stores its
+   * own keys. An empty table removes the layer. Takes effect at the next
+   * read.
+   */
+  void SetBaseLayer(const IniEmbeddedTable& table) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    base_tbl_.clear();
+    for (const auto& entry : table) {
+      base_tbl_.emplace_hint(base_tbl_.end(),
+                             IniStringPool::Instance().Intern(entry.key),
+                             IniStringPool::Instance().Intern(entry.value));
+    }
+    last_write_time_ = std_fs::file_time_type::min();
+  }
+  /// @brief Return the violations of the last rejected load, empty if the
+  /// current file was accepted.
+  std::vector<IniViolation> Violations() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return violations_;
+  }
+  /// @brief Return the generation of the table, bumped on every change.
+  std::uint64_t Generation() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return generation_;
+  }
+  /**
+   * @brief Return the current table in O(1). The snapshot never changes: it
+   * can be read without any lock while the instance reloads or `SetValue`
+   * publishes newer versions, which share most of their nodes with it. The
+   * keys are folded with `SetCaseInsensitive`, and only the parsed sections
+   * are in it with `SetLazySections`.
+   */
+  IniSnapshot Snapshot() {
+    std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+    SyncContentTbl(lock);
+    return content_tbl_;
+  }
+  /**
+   * @brief Reload the file if it changed, as every read but `Get` does. A
+   * caller reading only registered keys refreshes, e.g. once per request.
+   *
+   * @return IniErrc kMissing if the file doesn't exist, kIoError if it can't
+   * be read. A rejected file keeps serving the previous table.
+   */
+  IniErrc Refresh() {
+    std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+    return TrySyncContentTbl(lock);
+  }
+  /**
+   * @brief Keep the last `versions` published tables, the current one
+   * included, for `Versions()` and `Rollback()`; 0, the default, keeps none.
+   * The versions share their unchanged entries, so one costs about the
+   * entries that changed. The file is loaded at once even with lazy sections.
+   */
+  void SetHistory(std::size_t versions) {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    history_limit_ = versions;
+    if (lazy_file_.is_open()) {
+      last_write_time_ = std_fs::file_time_type::min();
+    } else if (history_.empty() && generation_ > 0) {
+      RecordVersion();
+    }
+    while (history_.size() > history_limit_) {
+      history_.pop_front();
+    }
+  }
+  /// @brief Return the kept versions, the oldest first, see `SetHistory`.
+  std::vector<IniVersion> Versions() {
+    std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+    return {history_.begin(), history_.end()};
+  }
+  /**
+   * @brief Publish a kept version again, in O(1), as a new generation. It is
+   * served until the file changes or, with `persist`, written to the file
+   * like `SetValue` writes without `SetPreserveFormat`. With includes,
+   * inheriting sections, interpolation, folded keys or a base layer the file
+   * can't be rebuilt from the table, and the next `SetValue` starts from the
+   * file again.
+   *
+   * @param version A version of `Versions()`.
+   * @param persist Whether to write the version to the file.
+   * @return IniErrc kMissing if `version` isn't kept, kInvalid if it must be
+   * persisted and can't be, both changing nothing, and kIoError if the write
+   * failed, the version being served anyway.
+   */
+  IniErrc Rollback(std::uint64_t version, bool persist = false);
+
+  // only the parsed sections are printed, see `SetLazySections`.
+  friend std::ostream& operator<<(std::ostream& os, const Settings& settings) {
+    for (auto& [key, value] : settings.content_tbl_) {
+      os << "*" << key << " = " << value << "\n";
+    }
+    return os;
+  }
+  void DumpFile() {
+    std::ifstream ifs(IniFullPath);
+    if (!ifs.is_open()) {
+      std::cerr << "Failed to open file: " << IniFullPath << "\n";
+      return;
+    }
+    std::string line;
+    while (std::getline(ifs, line)) {
+      std::cout << line << "\n";
+    }
+  }
+
+ private:
+  Settings() = default;
+  virtual ~Settings() = default;
+
+  // ***********  implementation ***********
+  // what a parse of the file depends on, copied under the lock.
+  struct ParseOptions {
+    bool lazy = false;
+    bool key_lines = false;
+    bool validate_utf8 = false;
+    IniLimits limits;
+    std::size_t diagnostics_limit = 0;
+    std::function<void(const IniDiagnostic&)> diagnostics_sink;
+  };
+  // a parse of the file, built without the lock.
+  struct ParsedFile {
+    IniErrc errc = IniErrc::kOk;
+    bool complete = true;
+    // open when the file was only indexed, see `SetLazySections`.
+    IniMappedFile lazy_file;
+    IniSectionIndex lazy_index;
+    StrStrMap tbl;
+    IniKeyLines key_lines;
+    std::vector<IniInclude> includes;
+    IniSectionParents parents;
+    IniDiagnostics diagnostics;
+  };
+  ParseOptions CurrentParseOptions() const;
+  static ParsedFile ParseFile(const ParseOptions& options);
+  IniErrc CommitParsedFile(ParsedFile parsed);
+  bool PublishContentTbl(StrStrMap own_tbl, std::vector<IniInclude> includes,
+                         IniSectionParents parents,
+                         const IniKeyLines& key_lines,
+                         std::vector<IniViolation>& violations);
+  bool ValidateContentTbl(StrStrMap& tbl,
+                          std::vector<IniViolation>& violations) const;
+  bool StoreContentTbl(const std::string& key, const std::string& value);
+  bool KeepsOwnTbl(const std::vector<IniInclude>& includes,
+                   const IniSectionParents& parents) const {
+    return interpolation_ || case_insensitive_ || !base_tbl_.empty() ||
+           !includes.empty() || !parents.empty();
+  }
+  IniErrc TrySyncContentTbl(std::unique_lock<std::mutex>& lock,
+                            bool for_write = false);
+  bool SyncContentTbl(std::unique_lock<std::mutex>& lock);
+  void OnContentTblChanged();
+  void RecordVersion();
+  void BindSlots();
+  const SharedStr* FindContent(const std::string& key);
+  void MaterializeSections(std::string_view key);
+  void MaterializeSection(IniSectionIndex::iterator section);
+  void MaterializeAllSections();
+  void EvictSections(std::string_view key);
+  void DropLazySections();
+  // protect read/write
+  std::mutex ini_rw_mutex_;
+  // a reload is parsing the file without the lock, see `TrySyncContentTbl`.
+  bool reloading_ = false;
+  std::condition_variable reloaded_;
+  IniPersistentMap content_tbl_;
+  std_fs::file_time_type last_write_time_;
+  // bumped whenever `content_tbl_` changes, and `derived_cache_` is dropped.
+  // Changed under the lock, read without it by `Get`.
+  std::atomic<std::uint64_t> generation_{0};
+  DerivedValueCache derived_cache_;
+  // the last published tables, the oldest first, see `SetHistory`.
+  std::size_t history_limit_ = 0;
+  std::deque<IniVersion> history_;
+  // a value of a slot converted to `T` by `Get`.
+  struct SlotValue {
+    const std::type_info* type;
+  };
+  template <typename T>
+  struct TypedSlotValue : SlotValue {
+    explicit TypedSlotValue(T converted)
+        : SlotValue{&typeid(T)}, value(std::move(converted)) {}
+    T value;
+  };
+  // the values of the registered keys in the table of `generation`, empty if
+  // missing. Never changed once published but for `converted`, which holds
+  // the last conversion of each slot and is swapped with `std::atomic_store`.
+  struct SlotTable {
+    std::uint64_t generation = 0;
+    std::vector<SharedStr> values;
+    mutable std::vector<std::shared_ptr<const SlotValue>> converted;
+  };
+  // the keys of `Register`, and their slots published with
+  // `std::atomic_store` for `Get` to read without the lock.
+  std::map<std::string, KeyId, std::less<>> slot_ids_;
+  std::vector<std::string> slot_keys_;
+  std::shared_ptr<const SlotTable> slots_;
+  std::multimap<std::string, IniConstraint> constraints_;
+  std::vector<IniViolation> violations_;
+  IniDiagnostics diagnostics_;
+  bool interpolation_ = false;
+  bool preserve_format_ = false;
+  bool case_insensitive_ = false;
+  bool validate_utf8_ = false;
+  IniLimits limits_;
+  // When the file has includes or inheriting sections, interpolation is on,
+  // the keys are folded or there is a base layer, `content_tbl_` isn't what
+  // the file says: `own_tbl_` holds the keys of the file as written, and
+  // `raw_tbl_` the table before interpolation.
+  StrStrMap own_tbl_;
+  StrStrMap raw_tbl_;
+  std::vector<IniInclude> includes_;
+  IniSectionParents parents_;
+  std::vector<IniIncludeCache::Stamp> include_stamps_;
+  // the keys under those of the file and its includes, see `SetBaseLayer`.
+  StrStrMap base_tbl_;
+  // With lazy sections, the sections of `lazy_index_` are in `lazy_file_`
+  // and not in `content_tbl_`, and the parsed ones are in `resident_`.
+  struct ResidentSection {
+    std::vector<IniByteRange> ranges;
+    std::vector<SharedStr> keys;
+    std::size_t bytes = 0;
+    std::list<std::string>::iterator lru;
+  };
+  bool lazy_sections_ = false;
+  IniMappedFile lazy_file_;
+  IniSectionIndex lazy_index_;
+  std::map<std::string, ResidentSection, std::less<>> resident_;
+  // the resident sections, the most recently read first.
+  std::list<std::string> lru_;
+  std::size_t memory_budget_ = 0;
+  std::size_t resident_bytes_ = 0;
+  std::uint64_t evictions_ = 0;
+  // stored in memory, and write back to the ini file when SetValue is called.
+};
+
+
+template <const char* IniFullPath>
+typename Settings<IniFullPath>::ParseOptions
+Settings<IniFullPath>::CurrentParseOptions() const {
+  ParseOptions options;
+  options.lazy = lazy_sections_ && !interpolation_ && constraints_.empty() &&
+                 !case_insensitive_ && limits_.IsUnlimited() &&
+                 history_limit_ == 0 && base_tbl_.empty();
+  options.key_lines = interpolation_;
+  options.validate_utf8 = validate_utf8_;
+  options.limits = limits_;
+  options.diagnostics_limit = diagnostics_.limit;
+  options.diagnostics_sink = diagnostics_.sink;
+  return options;
+}
+
+/**
+ * @brief Read the file, or only index its sections when it can be loaded
+ * lazily. Touches no member, so it runs without the lock.
+ */
+template <const char* IniFullPath>
+typename Settings<IniFullPath>::ParsedFile Settings<IniFullPath>::ParseFile(
+    const ParseOptions& options) {
+  ParsedFile parsed;
+  std::basic_ifstream<char> stream(IniFullPath, std::ios_base::in);
+  if (!stream) {
+    parsed.errc = IniErrc::kIoError;
+    return parsed;
+  }
+  stream.imbue(std::locale());
+  if (options.lazy) {
+    IniMappedFile file(IniFullPath);
+    if (file.is_open() && IndexIniSections(file.view(), parsed.lazy_index)) {
+      parsed.lazy_file = std::move(file);
+      return parsed;
+    }
+    parsed.lazy_index.clear();
+  }
+  parsed.diagnostics.limit = options.diagnostics_limit;
+  parsed.diagnostics.sink = options.diagnostics_sink;
+  // Read all the key-value pairs from the ini file
+  parsed.complete =
+      ReadIni(stream, parsed.tbl,
+              {options.key_lines ? &parsed.key_lines : nullptr,
+               &parsed.includes, &parsed.parents, &IniStringPool::Instance(),
+               &parsed.diagnostics, nullptr, options.validate_utf8,
+               &options.limits});
+  return parsed;
+}
+
+/**
+ * @brief Publish a parse of the file if it passes the constraints.
+ *
+ * @return IniErrc kIoError if the file couldn't be opened, kInvalid if it was
+ * rejected and `content_tbl_` is unchanged.
+ */
+template <const char* IniFullPath>
+IniErrc Settings<IniFullPath>::CommitParsedFile(ParsedFile parsed) {
+  if (parsed.errc != IniErrc::kOk) {
+    return parsed.errc;
+  }
+  if (parsed.lazy_file.is_open()) {
+    violations_.clear();
+    diagnostics_.entries.clear();
+    diagnostics_.dropped = 0;
+    own_tbl_.clear();
+    raw_tbl_.clear();
+    includes_.clear();
+    parents_.clear();
+    include_stamps_.clear();
+    content_tbl_ = {};
+    DropLazySections();
+    lazy_file_ = std::move(parsed.lazy_file);
+    lazy_index_.swap(parsed.lazy_index);
+    OnContentTblChanged();
+    IniStringPool::Instance().Collect();
+    return IniErrc::kOk;
+  }
+  diagnostics_.entries.swap(parsed.diagnostics.entries);
+  diagnostics_.dropped = parsed.diagnostics.dropped;
+  violations_.clear();
+  if (!parsed.complete) {
+    violations_.push_back({IniFullPath, "", "the parse limits"});
+    IniStringPool::Instance().Collect();
+    return IniErrc::kInvalid;
+  }
+  bool published = PublishContentTbl(
+      std::move(parsed.tbl), std::move(parsed.includes),
+      std::move(parsed.parents), parsed.key_lines, violations_);
+  // the strings of the replaced (or rejected) table are no longer used, and
+  // are released once enough of them piled up.
+  IniStringPool::Instance().Collect();
+  return published ? IniErrc::kOk : IniErrc::kInvalid;
+}
+
+/**
+ * @brief Build the table from the keys, includes and inheriting sections of
+ * the file: merge the includes, flatten the sections, interpolate and
+ * validate. Publish it if nothing is rejected.
+ *
+ * @param own_tbl The keys of the file.
+ * @param includes The includes of the file.
+ * @param parents The parents of the inheriting sections of the file.
+ * @param key_lines The line of each key of the file, for the reports.
+ * @param violations Receives the reasons of a rejection.
+ * @return false if rejected, then nothing changes.
+ */
+template <const char* IniFullPath>
+bool Settings<IniFullPath>::PublishContentTbl(
+    StrStrMap own_tbl, std::vector<IniInclude> includes,
+    IniSectionParents parents, const IniKeyLines& key_lines,
+    std::vector<IniViolation>& violations) {
+  bool keep_own = KeepsOwnTbl(includes, parents);
+  std::vector<IniIncludeCache::Stamp> stamps;
+  StrStrMap raw_tbl;
+  IniSectionParents all_parents;
+  if (!includes.empty() && !limits_.IsUnlimited()) {
+    // a bounded file is untrusted, and may not pull other files in.
+    for (const auto& include : includes) {
+      violations.push_back(
+          {"@include", include.path, "includes are rejected with limits"});
+    }
+    return false;
+  }
+  if (!includes.empty()) {
+    if (!IniIncludeCache::Instance().Merge(IniFullPath, includes, raw_tbl,
+                                           all_parents, stamps, violations)) {
+      return false;
+    }
+    for (const auto& [key, value] : own_tbl) {
+      raw_tbl.insert_or_assign(key, value);
+    }
+    for (const auto& [child, parent] : parents) {
+      all_parents.insert_or_assign(child, parent);
+    }
+  } else if (keep_own) {
+    raw_tbl = own_tbl;
+    all_parents = parents;
+  } else {
+    raw_tbl.swap(own_tbl);
+  }
+  if (case_insensitive_) {
+    FoldIniKeys(raw_tbl, all_parents);
+  }
+  for (const auto& [key, value] : base_tbl_) {
+    if (case_insensitive_) {
+      raw_tbl.emplace(IniStringPool::Instance().Intern(FoldAsciiCase(key)),
+                      value);
+    } else {
+      raw_tbl.emplace(key, value);
+    }
+  }
+  if (!InheritSections(raw_tbl, all_parents, violations)) {
+    return false;
+  }
+  StrStrMap new_tbl;
+  if (interpolation_) {
+    InterpolateTbl(raw_tbl, key_lines, &raw_tbl_, &content_tbl_, new_tbl,
+                   violations);
+    if (!violations.empty()) {
+      return false;
+    }
+  } else {
+    new_tbl.swap(raw_tbl);
+  }
+  if (!ValidateContentTbl(new_tbl, violations)) {
+    return false;
+  }
+  own_tbl_.swap(own_tbl);
+  raw_tbl_.swap(raw_tbl);
+  includes_.swap(includes);
+  parents_.swap(parents);
+  include_stamps_.swap(stamps);
+  content_tbl_ = content_tbl_.Update(new_tbl);
+  DropLazySections();
+  OnContentTblChanged();
+  return true;
+}
+
+/**
+ * @brief Apply the constraints to `tbl`, clamping values in place.
+ *
+ * @return false if a value was rejected, see `violations`.
+ */
+template <const char* IniFullPath>
+bool Settings<IniFullPath>::ValidateContentTbl(
+    StrStrMap& tbl, std::vector<IniViolation>& violations) const {
+  auto count = violations.size();
+  for (const auto& [key, constraint] : constraints_) {
+    auto it = tbl.find(case_insensitive_ ? FoldAsciiCase(key) : key);
+    if (it == tbl.end()) {
+      continue;
+    }
+    std::string value = it->second.str();
+    if (!constraint.Apply(value)) {
+      violations.push_back({key, it->second.str(), constraint.Description()});
+    } else if (it->second != value) {
+      it->second = value;
+    }
+  }
+  return violations.size() == count;
+}
+
+template <const char* IniFullPath>
+void Settings<IniFullPath>::OnContentTblChanged() {
+  ++generation_;
+  derived_cache_.Clear();
+  RecordVersion();
+}
+
+template <const char* IniFullPath>
+void Settings<IniFullPath>::RecordVersion() {
+  if (history_limit_ == 0) {
+    return;
+  }
+  history_.push_back(
+      {generation_, std::chrono::system_clock::now(), content_tbl_});
+  while (history_.size() > history_limit_) {
+    history_.pop_front();
+  }
+}
+
+template <const char* IniFullPath>
+IniErrc Settings<IniFullPath>::Rollback(std::uint64_t version, bool persist) {
+  std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+  auto it = std::find_if(
+      history_.begin(), history_.end(),
+      [&](const IniVersion& kept) { return kept.version == version; });
+  if (it == history_.end()) {
+    return IniErrc::kMissing;
+  }
+  if (persist && KeepsOwnTbl(includes_, parents_)) {
+    return IniErrc::kInvalid;
+  }
+  if (version != generation_) {
+    content_tbl_ = it->snapshot;
+    // the next interpolation can't reuse values of the current table.
+    raw_tbl_.clear();
+    OnContentTblChanged();
+  }
+  if (!persist) {
+    return IniErrc::kOk;
+  }
+  if (!ReplaceIniFile(IniFullPath, [this](std::ostream& stream) {
+        WriteIni(stream, content_tbl_);
+      })) {
+    return IniErrc::kIoError;
+  }
+  last_write_time_ = std_fs::last_write_time(IniFullPath);
+  return IniErrc::kOk;
+}
+
+/// @brief Look the registered keys up in the current table and publish them.
+template <const char* IniFullPath>
+void Settings<IniFullPath>::BindSlots() {
+  auto slots = std::make_shared<SlotTable>();
+  slots->generation = generation_;
+  slots->values.reserve(slot_keys_.size());
+  for (const auto& key : slot_keys_) {
+    const SharedStr* value = FindContent(key);
+    slots->values.push_back(value ? *value : SharedStr());
+  }
+  slots->converted.resize(slot_keys_.size());
+  std::atomic_store(&slots_, std::shared_ptr<const SlotTable>(std::move(slots)));
+}
+
+/**
+ * @brief Find `key` in `content_tbl_`, parsing its section first if needed.
+ * With `SetCaseInsensitive`, the key is folded on the stack first.
+ */
+template <const char* IniFullPath>
+const SharedStr* Settings<IniFullPath>::FindContent(const std::string& key) {
+  if (case_insensitive_) {
+    char buffer[256];
+    std::string long_key;
+    char* folded = buffer;
+    if (key.size() > sizeof(buffer)) {
+      long_key.resize(key.size());
+      folded = long_key.data();
+    }
+    FoldAsciiCase(key.data(), key.size(), folded);
+    return content_tbl_.Find(std::string_view(folded, key.size()));
+  }
+  MaterializeSections(key);
+  return content_tbl_.Find(key);
+}
+
+/**
+ * @brief Parse the pending sections that may hold `key` into `content_tbl_`
+ * and mark the resident ones as recently used. A section name may contain
+ * dots, so every prefix of `key` is a candidate. Runs under `ini_rw_mutex_`,
+ * so each section is parsed once until it is evicted.
+ */
+template <const char* IniFullPath>
+void Settings<IniFullPath>::MaterializeSections(std::string_view key) {
+  if (lazy_index_.empty() && resident_.empty()) {
+    return;
   }
-  if constexpr (std::is_same<T, std::string>::value) {
-    return value;
-  } else if constexpr (std::is_same<T, int>::value) {
-    std::string::size_type sz;
-    return std::stoi(value, &sz);
-  } else if constexpr (std::is_same<T, float>::value) {
-    std::string::size_type sz;
-    return std::stof(value, &sz);
-  } else if constexpr (std::is_same<T, double>::value) {
-    std::string::size_type sz;
-    return std::stod(value, &sz);
-  } else if constexpr (std::is_same<T, bool>::value) {
-    return value == "true" || value == "1";
-  }
-  return default_value;
-}
-
-/// @brief Trim the string `s` with the locale `loc`.
-template <class Str>
-Str Trim(const Str& s, const std::locale& loc = std::locale()) {
-  typename Str::const_iterator first = s.begin();
-  typename Str::const_iterator end = s.end();
-  while (first != end && std::isspace(*first, loc)) {
-    ++first;
+  for (auto dot = key.find('.'); dot != std::string_view::npos;
+       dot = key.find('.', dot + 1)) {
+    auto name = key.substr(0, dot);
+    auto resident = resident_.find(name);
+    if (resident != resident_.end()) {
+      lru_.splice(lru_.begin(), lru_, resident->second.lru);
+      continue;
+    }
+    auto section = lazy_index_.find(name);
+    if (section != lazy_index_.end()) {
+      MaterializeSection(section);
+    }
   }
+  EvictSections(key);
+}
 
-  if (first == end) {
-    return Str();
+/// @brief Parse a pending section into `content_tbl_` and make it resident.
+template <const char* IniFullPath>
+void Settings<IniFullPath>::MaterializeSection(
+    IniSectionIndex::iterator section) {
+  StrStrMap tbl;
+  for (const auto& range : section->second) {
+    std::istringstream stream(std::string(
+        lazy_file_.view().substr(range.begin, range.end - range.begin)));
+    ReadIni(stream, tbl,
+            {nullptr, nullptr, nullptr, &IniStringPool::Instance()});
+  }
+  ResidentSection resident;
+  resident.ranges = std::move(section->second);
+  resident.keys.reserve(tbl.size());
+  for (auto& [key, value] : tbl) {
+    // an estimate: the node of the table and the characters.
+    resident.bytes += IniPersistentMap::NodeBytes() + key.size() + value.size();
+    resident.keys.push_back(key);
+    content_tbl_ = content_tbl_.Set(key, value);
   }
+  resident_bytes_ += resident.bytes;
+  lru_.push_front(section->first);
+  resident.lru = lru_.begin();
+  resident_.emplace(section->first, std::move(resident));
+  lazy_index_.erase(section);
+}
 
-  typename Str::const_iterator last = end;
-  do {
-    --last;
-  } while (std::isspace(*last, loc));
-  if (first != s.begin() || last + 1 != end) {
-    return Str(first, last + 1);
-  } else {
-    return s;
+template <const char* IniFullPath>
+void Settings<IniFullPath>::MaterializeAllSections() {
+  while (!lazy_index_.empty()) {
+    MaterializeSection(lazy_index_.begin());
   }
 }
 
 /**
- * @brief Split the string `str` with the `pattern`.
- *
- * @param str
- * @param pattern
- * @return std::vector<std::string>
+ * @brief Evict the least recently used sections until the resident ones fit
+ * in the budget. The sections that may hold `key` are kept, they were just
+ * read.
  */
-inline std::vector<std::string> Split(const std::string& str,
-                                      const std::string& pattern) {
-  std::vector<std::string> result;
-  if (str.empty()) {
-    return result;
-  }
-  size_t start = 0;
-  size_t index = str.find_first_of(pattern, start);
-  while (index != std::string::npos) {
-    if (index != start) {
-      result.push_back(str.substr(start, index - start));
+template <const char* IniFullPath>
+void Settings<IniFullPath>::EvictSections(std::string_view key) {
+  while (memory_budget_ > 0 && resident_bytes_ > memory_budget_ &&
+         !lru_.empty()) {
+    const auto& name = lru_.back();
+    if (key.size() > name.size() && key[name.size()] == '.' &&
+        key.compare(0, name.size(), name) == 0) {
+      break;
     }
-    start = index + 1;
-    index = str.find_first_of(pattern, start);
-  }
-  if (!str.substr(start).empty()) {
-    result.push_back(str.substr(start));
+    auto resident = resident_.find(name);
+    for (const auto& resident_key : resident->second.keys) {
+      content_tbl_ = content_tbl_.Erase(resident_key);
+    }
+    resident_bytes_ -= resident->second.bytes;
+    lazy_index_.emplace(name, std::move(resident->second.ranges));
+    resident_.erase(resident);
+    lru_.pop_back();
+    ++evictions_;
   }
-  return result;
+}
+
+/// @brief Forget the lazy sections, the parsed ones stay in `content_tbl_`.
+template <const char* IniFullPath>
+void Settings<IniFullPath>::DropLazySections() {
+  lazy_index_.clear();
+  resident_.clear();
+  lru_.clear();
+  resident_bytes_ = 0;
+  lazy_file_ = IniMappedFile();
 }
 
 /**
- * @brief A class to parse `ini` setting files.
+ * @brief Reload `content_tbl_` if the file changed since the last load.
  *
- * @param `IniFullPath` The full path of the `ini` file.
+ * Reloads are single-flight: the first reader to see the change parses the
+ * file with `lock` released, while the other readers keep serving the
+ * previous table rather than waiting, and the new table is published under
+ * the lock. Only a first load is waited for. A parse overtaken by a write or
+ * a changed option is dropped, and the next read parses again.
+ *
+ * @param lock The held lock of `ini_rw_mutex_`.
+ * @param for_write Whether a write follows: then a reload in flight is waited
+ * for and an overtaken parse is done again, so the write starts from the
+ * current file.
+ * @return IniErrc kMissing if the file doesn't exist, kIoError if it can't be
+ * read.
  */
 template <const char* IniFullPath>
-class Settings {
- public:
-  static Settings& GetInstance() {
-    static Settings* ins = nullptr;
-    if (!ins) {
-      static std::once_flag flag;
-      std::call_once(flag, [&]() { ins = new (std::nothrow) Settings(); });
+IniErrc Settings<IniFullPath>::TrySyncContentTbl(
+    std::unique_lock<std::mutex>& lock, bool for_write) {
+  std::error_code ec;
+  if (!std_fs::exists(IniFullPath, ec)) {
+    if (ec || base_tbl_.empty()) {
+      return ec ? IniErrc::kIoError : IniErrc::kMissing;
     }
-    return *ins;
-  }
-  // Tear down the singleton
-  static void DestroyInstance() {
-    Settings* ins = &GetInstance();
-    if (!ins) {
-      static std::once_flag release_flag;
-      std::call_once(release_flag, [&]() { delete ins; });
+    // the base layer alone, published once: `max` stands for no file, so
+    // the file is loaded when it appears.
+    if (last_write_time_ != std_fs::file_time_type::max()) {
+      violations_.clear();
+      if (!PublishContentTbl({}, {}, {}, {}, violations_)) {
+        return IniErrc::kInvalid;
+      }
+      last_write_time_ = std_fs::file_time_type::max();
     }
+    return IniErrc::kOk;
   }
-  // disable copy and move
-  Settings(Settings const&) = delete;
-  Settings& operator=(Settings const&) = delete;
-  Settings(Settings&&) = delete;
-  Settings& operator=(Settings&&) = delete;
-
-  // ***********  interfaces ***********
-  /**
-   * @brief Return the full path of the `ini` file.
-   *
-   * @return const char*
-   */
-  std::string GetFullPath() const { return IniFullPath; }
-  /**
-   * @brief Get the value of the `key` from the `ini` file. If the `key` doesn't
-   * exist, return the `default_value`.
-   *
-   * @tparam T The type of the value.
-   * @tparam Types The type of the format string.
-   * @param default_value The default value if the `key` doesn't exist.
-   * @param fmt The format string to get the string of the key.
-   * @param args The arguments of the format string.
-   * @return T
-   */
-  template <typename T, typename... Types, enable_if_supported_type<T> = 0>
-  T GetValue2(const T& default_value, const std::string& fmt, Types&&... args);
-  /**
-   * @brief Get the value of the `key` from the `ini` file. If the `key` doesn't
-   * exist, return the `default_value`.
-   *
-   * @tparam T
-   * @param key
-   * @param default_value
-   * @return T
-   */
-  template <typename T, enable_if_supported_type<T> = 0>
-  T GetValue(const std::string& key, T default_value = T());
-  /**
-   * @brief Save/change the `value` to the `key` to the `ini` file.
-   *
-   * @tparam T
-   * @param key The key of the value.
-   * @param value The value to be saved.
-   */
-  template <typename T, enable_if_supported_type<T> = 0>
-  void SetValue(const std::string& key, const T& value);
-
-  friend std::ostream& operator<<(std::ostream& os, const Settings& settings) {
-    for (auto& [key, value] : settings.content_tbl_) {
-      os << "*" << key << " = " << value << "\n";
-    }
-    return os;
+  auto write_time = std_fs::last_write_time(IniFullPath, ec);
+  if (ec) {
+    return IniErrc::kIoError;
   }
-  void DumpFile() {
-    std::ifstream ifs(IniFullPath);
-    if (!ifs.is_open()) {
-      std::cerr << "Failed to open file: " << IniFullPath << "\n";
-      return;
-    }
-    std::string line;
-    while (std::getline(ifs, line)) {
-      std::cout << line << "\n";
+  // no updates, use the memory content_tbl_
+  bool changed = last_write_time_ != write_time;
+  for (std::size_t i = 0; !changed && i < include_stamps_.size(); ++i) {
+    changed = std_fs::last_write_time(include_stamps_[i].path, ec) !=
+                  include_stamps_[i].write_time ||
+              ec;
+  }
+  if (!changed) {
+    return IniErrc::kOk;
+  }
+  if (reloading_) {
+    if (generation_ != 0 && !for_write) {
+      return IniErrc::kOk;
     }
+    reloaded_.wait(lock, [this]() { return !reloading_; });
+    return TrySyncContentTbl(lock, for_write);
   }
+  auto options = CurrentParseOptions();
+  auto seen_write_time = last_write_time_;
+  std::uint64_t seen_generation = generation_;
+  ParsedFile parsed;
+  {
+    // relocks and ends the flight, even if the parse throws.
+    struct Flight {
+      Settings* settings;
+      std::unique_lock<std::mutex>& lock;
+      ~Flight() {
+        lock.lock();
+        settings->reloading_ = false;
+        settings->reloaded_.notify_all();
+      }
+    };
+    reloading_ = true;
+    lock.unlock();
+    Flight flight{this, lock};
+    parsed = ParseFile(options);
+  }
+  if (last_write_time_ != seen_write_time || generation_ != seen_generation) {
+    return for_write ? TrySyncContentTbl(lock, true) : IniErrc::kOk;
+  }
+  // a rejected file keeps serving the previous table until it changes.
+  if (CommitParsedFile(std::move(parsed)) == IniErrc::kIoError) {
+    return IniErrc::kIoError;
+  }
+  last_write_time_ = write_time;
+  return IniErrc::kOk;
+}
 
- private:
-  Settings() = default;
-  virtual ~Settings() = default;
-
-  // ***********  implementation ***********
-  bool LoadContentTbl();
-  bool StoreContentTbl();
-  // protect read/write
-  std::mutex ini_rw_mutex_;
-  StrStrMap content_tbl_;
-  std_fs::file_time_type last_write_time_;
-  // stored in memory, and write back to the ini file when SetValue is called.
-};
-
-static inline void WriteIni(std::basic_ostream<char>& stream,
-                            const StrStrMap& ini_content_tbl);
-static inline void ReadIni(std::basic_istream<char>& stream,
-                           StrStrMap& ini_content_tbl);
-
+/**
+ * @brief Reload `content_tbl_` if the file changed since the last load.
+ *
+ * @return false if the file doesn't exist.
+ * @throw std::runtime_error if the file can't be opened.
+ */
 template <const char* IniFullPath>
-bool Settings<IniFullPath>::LoadContentTbl() {
-  std::basic_ifstream<char> stream(IniFullPath, std::ios_base::in);
-  if (!stream) {
-    return false;
+bool Settings<IniFullPath>::SyncContentTbl(
+    std::unique_lock<std::mutex>& lock) {
+  auto errc = TrySyncContentTbl(lock);
+  if (errc == IniErrc::kIoError) {
+    INI_THROW(std::runtime_error(std::string(IniFullPath) +
+                                 " open failed, maybe permission denied."));
   }
-  stream.imbue(std::locale());
-  content_tbl_.clear();
-  // Read all the key-value pairs from the ini file
-  ReadIni(stream, content_tbl_);
-  return true;
+  return errc == IniErrc::kOk;
 }
 
+/**
+ * @brief Write the table back to the file after `key` was set to `value`.
+ * With `SetPreserveFormat`, only the line of `key` changes.
+ */
 template <const char* IniFullPath>
-bool Settings<IniFullPath>::StoreContentTbl() {
-  std::basic_ofstream<char> stream(IniFullPath);
-  if (!stream) {
+bool Settings<IniFullPath>::StoreContentTbl(const std::string& key,
+                                            const std::string& value) {
+  IniDocument document;
+  if (preserve_format_) {
+    std::ifstream file(IniFullPath, std::ios_base::in | std::ios_base::binary);
+    document = IniDocument(std::string(std::istreambuf_iterator<char>(file),
+                                       std::istreambuf_iterator<char>()));
+    document.SetValue(key, value);
+  }
+  bool written = ReplaceIniFile(IniFullPath, [&](std::ostream& stream) {
+    if (preserve_format_) {
+      document.Write(stream);
+      return;
+    }
+    for (const auto& include : includes_) {
+      stream << "@include " << include.path << static_cast<Ch>('\n');
+    }
+    if (KeepsOwnTbl(includes_, parents_)) {
+      WriteIni(stream, own_tbl_, parents_);
+    } else {
+      WriteIni(stream, content_tbl_, parents_);
+    }
+  });
+  if (!written) {
     return false;
   }
-  stream.imbue(std::locale());
-  WriteIni(stream, content_tbl_);
   last_write_time_ = std_fs::last_write_time(IniFullPath);
   return true;
 }
@@ -264,8 +4023,8 @@ template <const char* IniFullPath>
 template <typename T, typename... Types, enable_if_supported_type<T>>
 T Settings<IniFullPath>::GetValue2(const T& default_value,
                                    const std::string& fmt, Types&&... args) {
-  std::lock_guard<std::mutex> lock(ini_rw_mutex_);
-  if (!std_fs::exists(IniFullPath)) {
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+  if (!SyncContentTbl(lock)) {
     return default_value;
   }
 
@@ -279,48 +4038,165 @@ T Settings<IniFullPath>::GetValue2(const T& default_value,
     return std::string(args_buf.get(), args_buf.get() + args_size - 1);
   };
   std::string key = formatString(fmt, std::forward<Types>(args)...);
-
-  // no updates, use the memory content_tbl_
-  if (last_write_time_ != std_fs::last_write_time(IniFullPath)) {
-    if (!LoadContentTbl()) {
-      std::string err_msg = IniFullPath;
-      err_msg += " open failed, maybe permission denied.";
-      throw std::runtime_error(err_msg);
-    }
-    last_write_time_ = std_fs::last_write_time(IniFullPath);
-  }
-  if (content_tbl_.find(key) == content_tbl_.end()) {
+  auto value = FindContent(key);
+  if (!value) {
     return default_value;
   }
-  return ConvertValue(content_tbl_.at(key), default_value);
+  return ConvertValue(*value, default_value);
 }
 
 template <const char* IniFullPath>
 template <typename T, enable_if_supported_type<T>>
 T Settings<IniFullPath>::GetValue(const std::string& key, T default_value) {
-  std::lock_guard<std::mutex> lock(ini_rw_mutex_);
-  if (!std_fs::exists(IniFullPath)) {
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+  if (!SyncContentTbl(lock)) {
     return default_value;
   }
-  // no updates, use the memory content_tbl_
-  if (last_write_time_ != std_fs::last_write_time(IniFullPath)) {
-    if (!LoadContentTbl()) {
-      std::string err_msg = IniFullPath;
-      err_msg += " open failed, maybe permission denied.";
-      throw std::runtime_error(err_msg);
+  auto value = FindContent(key);
+  if (!value) {
+    return default_value;
+  }
+  return ConvertValue(*value, default_value);
+}
+
+template <const char* IniFullPath>
+typename Settings<IniFullPath>::KeyId Settings<IniFullPath>::Register(
+    std::string_view key) {
+  std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+  auto it = slot_ids_.find(key);
+  if (it != slot_ids_.end()) {
+    return it->second;
+  }
+  auto id = static_cast<KeyId>(slot_keys_.size());
+  slot_ids_.emplace(key, id);
+  slot_keys_.emplace_back(key);
+  // bound now if the other slots are, or with them at the next `Get`.
+  if (slots_ && slots_->generation == generation_) {
+    auto slots = std::make_shared<SlotTable>();
+    slots->generation = slots_->generation;
+    slots->values = slots_->values;
+    for (auto& converted : slots_->converted) {
+      slots->converted.push_back(std::atomic_load(&converted));
     }
-    last_write_time_ = std_fs::last_write_time(IniFullPath);
+    const SharedStr* value = FindContent(slot_keys_.back());
+    slots->values.push_back(value ? *value : SharedStr());
+    slots->converted.emplace_back();
+    std::atomic_store(&slots_,
+                      std::shared_ptr<const SlotTable>(std::move(slots)));
+  }
+  return id;
+}
+
+template <const char* IniFullPath>
+template <typename T, enable_if_supported_type<T>>
+T Settings<IniFullPath>::Get(KeyId id, T default_value) {
+  auto slots = std::atomic_load(&slots_);
+  if (!slots || slots->generation != generation_ ||
+      id >= slots->values.size()) {
+    // the first read, or the table changed: the file is checked, as by any
+    // read, and the slots are bound again.
+    std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+    if (!SyncContentTbl(lock)) {
+      return default_value;
+    }
+    if (!slots_ || slots_->generation != generation_) {
+      BindSlots();
+    }
+    slots = slots_;
+    if (id >= slots->values.size()) {
+      return default_value;
+    }
+  }
+  const SharedStr& value = slots->values[id];
+  if (value.empty()) {
+    return default_value;
+  }
+  auto converted = std::atomic_load(&slots->converted[id]);
+  if (converted && *converted->type == typeid(T)) {
+    return static_cast<const TypedSlotValue<T>&>(*converted).value;
+  }
+  // a slot read as another type is converted again, and keeps the last one.
+  auto typed = std::make_shared<const TypedSlotValue<T>>(
+      ConvertValue(value, default_value));
+  std::atomic_store(&slots->converted[id],
+                    std::shared_ptr<const SlotValue>(typed));
+  return typed->value;
+}
+
+template <const char* IniFullPath>
+template <typename T, enable_if_supported_type<T>>
+IniExpected<T> Settings<IniFullPath>::TryGetValue(const std::string& key) {
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+  auto errc = TrySyncContentTbl(lock);
+  if (errc != IniErrc::kOk) {
+    return IniUnexpected(errc);
+  }
+  auto value = FindContent(key);
+  if (!value) {
+    return IniUnexpected(IniErrc::kMissing);
+  }
+  return TryConvertValue<T>(*value);
+}
+
+template <const char* IniFullPath>
+template <typename T, enable_if_supported_type<T>>
+T Settings<IniFullPath>::GetCachedValue(const std::string& key,
+                                        T default_value) {
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+  if (!SyncContentTbl(lock)) {
+    return default_value;
   }
-  if (content_tbl_.find(key) == content_tbl_.end()) {
+  auto value = FindContent(key);
+  if (!value || value->empty()) {
     return default_value;
   }
-  return ConvertValue(content_tbl_.at(key), default_value);
+  return *derived_cache_.GetOrCreate<T>(
+      key, [&]() { return ConvertValue(*value, default_value); });
+}
+
+template <const char* IniFullPath>
+template <typename T, enable_if_supported_type<T>>
+std::shared_ptr<const std::vector<T>> Settings<IniFullPath>::GetList(
+    const std::string& key, const std::string& sep) {
+  static const auto empty_list = std::make_shared<const std::vector<T>>();
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
+  if (!SyncContentTbl(lock)) {
+    return empty_list;
+  }
+  auto list_value = FindContent(key);
+  if (!list_value) {
+    return empty_list;
+  }
+  std::string cache_key = key;
+  cache_key += '\0';
+  cache_key += sep;
+  return derived_cache_.GetOrCreate<std::vector<T>>(cache_key, [&]() {
+    std::vector<T> list;
+    for (auto token : SplitView(list_value->view(), sep)) {
+      auto element = Trim(token);
+      if (element.empty()) {
+        continue;
+      }
+      T value{};
+      auto ec = ValueTraits<T>::Parse(element, value);
+      if (ec == std::errc::result_out_of_range) {
+        INI_THROW(std::out_of_range("GetList: out of range: " +
+                                    std::string(element)));
+      }
+      if (ec != std::errc{}) {
+        INI_THROW(std::invalid_argument("GetList: malformed element: " +
+                                        std::string(element)));
+      }
+      list.push_back(std::move(value));
+    }
+    return list;
+  });
 }
 
 template <const char* IniFullPath>
 template <typename T, enable_if_supported_type<T>>
 void Settings<IniFullPath>::SetValue(const std::string& key, const T& value) {
-  std::lock_guard<std::mutex> lock(ini_rw_mutex_);
+  std::unique_lock<std::mutex> lock(ini_rw_mutex_);
   if (!std_fs::exists(IniFullPath)) {
     std::cout << IniFullPath << " doesn't exist, create a new one."
               << "\n";
@@ -329,7 +4205,7 @@ void Settings<IniFullPath>::SetValue(const std::string& key, const T& value) {
       std::cout << "Create directory: " << ini_parent_path << "\n";
       if (!std_fs::create_directories(ini_parent_path)) {
         // maybe permission denied
-        throw std::runtime_error("Path create failed");
+        INI_THROW(std::runtime_error("Path create failed"));
       }
     }
     auto create_ini_file = [](const std::string& ini_path) -> bool {
@@ -341,35 +4217,88 @@ void Settings<IniFullPath>::SetValue(const std::string& key, const T& value) {
     };
     if (!create_ini_file(IniFullPath)) {
       // maybe permission denied
-      throw std::runtime_error("File create failed");
+      INI_THROW(std::runtime_error("File create failed"));
     }
     std::cout << "Create regular file: " << IniFullPath << "\n";
     last_write_time_ = std_fs::last_write_time(IniFullPath);
   }
 
-  // load before write
-  if (last_write_time_ != std_fs::last_write_time(IniFullPath)) {
-    if (!LoadContentTbl()) {
-      std::string err_msg = IniFullPath;
-      err_msg += " open failed, maybe permission denied.";
-      throw std::runtime_error(err_msg);
-    }
+  // load before write, the file parsed without the lock like for the readers.
+  if (TrySyncContentTbl(lock, true) == IniErrc::kIoError) {
+    INI_THROW(std::runtime_error(std::string(IniFullPath) +
+                                 " open failed, maybe permission denied."));
+  }
+  if (!violations_.empty()) {
+    // don't overwrite the operator's changes with the last good table.
+    INI_THROW(std::runtime_error(std::string(IniFullPath) +
+                                 " violates the constraints."));
   }
+  // the whole table is written back, and the file is unmapped before.
+  MaterializeAllSections();
+  bool reindex = lazy_file_.is_open();
+  DropLazySections();
 
-  std::string value_string;
-  if constexpr (!std::is_same<typename std::decay<T>::type,
-                              std::string>::value) {
-    value_string = std::to_string(value);
+  std::string value_string =
+      ValueTraits<typename std::decay<T>::type>::Format(value);
+  // the key as the file spells it when only the case differs, or else its
+  // section as the file spells it, so the key isn't added to a new section.
+  std::string own_key = key;
+  if (case_insensitive_) {
+    std::size_t respelled = 0;
+    for (const auto& entry : own_tbl_) {
+      auto own = entry.first.view();
+      if (EqualsNoCase(own, key)) {
+        own_key = entry.first.str();
+        break;
+      }
+      // the longest prefix ending before a `.` that both keys share.
+      std::size_t common = 0;
+      while (common < own.size() && common < key.size() &&
+             ToLowerAscii(own[common]) == ToLowerAscii(key[common])) {
+        ++common;
+      }
+      auto dot = key.rfind('.', common == 0 ? 0 : common - 1);
+      if (dot != std::string::npos && dot < common && dot > respelled) {
+        own_key.replace(0, dot, own.substr(0, dot));
+        respelled = dot;
+      }
+    }
+  }
+  if (KeepsOwnTbl(includes_, parents_)) {
+    // rebuild from the keys of the file, the includes come from the cache and
+    // only the dependents of `key` are interpolated again.
+    StrStrMap own_tbl = own_tbl_;
+    own_tbl.insert_or_assign(IniStringPool::Instance().Intern(own_key),
+                             IniStringPool::Instance().Intern(value_string));
+    std::vector<IniViolation> violations;
+    if (!PublishContentTbl(std::move(own_tbl), includes_, parents_, {},
+                           violations)) {
+      INI_THROW(std::invalid_argument(violations[0].key + " = " +
+                                      violations[0].value + " violates " +
+                                      violations[0].constraint));
+    }
   } else {
-    value_string = value;
+    auto range = constraints_.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (!it->second.Apply(value_string)) {
+        INI_THROW(std::invalid_argument(key + " = " + value_string +
+                                        " violates " +
+                                        it->second.Description()));
+      }
+    }
+    // a new version sharing all but the path to `key` with the current one.
+    content_tbl_ =
+        content_tbl_.Set(IniStringPool::Instance().Intern(key),
+                         IniStringPool::Instance().Intern(value_string));
+    OnContentTblChanged();
   }
-
-  // insert or update
-  content_tbl_.insert_or_assign(key, value_string);
-  if (!StoreContentTbl()) {
-    std::string err_msg = IniFullPath;
-    err_msg += " write failed, maybe permission denied.";
-    throw std::runtime_error(err_msg);
+  if (!StoreContentTbl(own_key, value_string)) {
+    INI_THROW(std::runtime_error(std::string(IniFullPath) +
+                                 " write failed, maybe permission denied."));
+  }
+  if (reindex) {
+    // the lazy sections of the new file are indexed at the next read.
+    last_write_time_ = std_fs::file_time_type::min();
   }
 }
 /**
@@ -377,41 +4306,60 @@ void Settings<IniFullPath>::SetValue(const std::string& key, const T& value) {
  *
  * @tparam IniFullPath
  * @param stream
- * @param ini_content_tbl The key-value tables to be written to ini files.
+ * @param ini_content_tbl The key-value tables to be written to ini files, a
+ * `StrStrMap` or an `IniPersistentMap`.
+ * @param parents The parents of the `[child : parent]` sections.
  */
-void WriteIni(std::basic_ostream<char>& stream,
-              const StrStrMap& ini_content_tbl) {
-  std::set<std::string> sec_name_set;
+template <typename Tbl>
+void WriteIni(std::basic_ostream<char>& stream, const Tbl& ini_content_tbl,
+              const IniSectionParents& parents) {
+  std::set<std::string, std::less<>> sec_name_set;
+  auto write_header = [&](std::string_view section_name) {
+    if (!sec_name_set.empty()) {
+      stream << static_cast<Ch>('\n');
+    }
+    stream << static_cast<Ch>('[') << section_name;
+    auto parent = parents.find(std::string(section_name));
+    if (parent != parents.end()) {
+      stream << " : " << parent->second;
+    }
+    stream << static_cast<Ch>(']') << static_cast<Ch>('\n');
+    sec_name_set.emplace(section_name);
+  };
   for (auto& [combined_key, value] : ini_content_tbl) {
     if (value.empty()) {
       // always ignore empty value. it make no sense.
       continue;
     }
-    auto combined_key_vec = Split(combined_key, ".");
-    if (combined_key_vec.size() < 2) {
-      // no section or key: invalid data
+    SplitView tokens(combined_key.view(), ".");
+    auto token = tokens.begin();
+    if (token == tokens.end() || std::next(token) == tokens.end()) {
+      // no section or key: invalid data, skipped.
       // std::cerr << "Invalid data: " << combined_key << "\n";
-      break;
+      continue;
     }
-    auto& section_name = combined_key_vec[0];
+    auto section_name = *token;
     if (sec_name_set.find(section_name) == sec_name_set.end()) {
-      if (sec_name_set.empty()) {
-        stream << static_cast<Ch>('[') << section_name << static_cast<Ch>(']')
-               << static_cast<Ch>('\n');
-      } else {
-        stream << static_cast<Ch>('\n') << static_cast<Ch>('[') << section_name
-               << static_cast<Ch>(']') << static_cast<Ch>('\n');
-      }
-      sec_name_set.insert(section_name);
+      write_header(section_name);
     }
-    std::string key;
-    for (std::size_t i = 1; i < combined_key_vec.size(); i++) {
-      if (!key.empty()) {
-        key += ".";
-      }
-      key += combined_key_vec[i];
+    // the key is the rest of the tokens.
+    stream << *++token;
+    while (++token != tokens.end()) {
+      stream << static_cast<Ch>('.') << *token;
+    }
+    stream << static_cast<Ch>('=');
+    if (NeedsIniQuotes(value)) {
+      stream << QuoteIniValue(value);
+    } else {
+      stream << value;
+    }
+    stream << static_cast<Ch>('\n');
+  }
+  // the inheriting sections without keys of their own.
+  for (const auto& [child, parent] : parents) {
+    if (sec_name_set.find(child) == sec_name_set.end()) {
+      write_header(child);
     }
-    stream << key << static_cast<Ch>('=') << value << static_cast<Ch>('\n');
   }
 }
 /**
@@ -421,79 +4369,190 @@ void WriteIni(std::basic_ostream<char>& stream,
  * @tparam IniFullPath
  * @param stream
  * @param ini_content_tbl
+ * @param context The optional outputs.
+ * @return false if the parse stopped at a bound of `context.limits`, then
+ * `ini_content_tbl` holds the keys read before.
  */
-void ReadIni(std::basic_istream<char>& stream, StrStrMap& ini_content_tbl) {
-  typedef std::basic_string<Ch> Str;
-  const Ch semicolon = stream.widen(';');
-  const Ch hash = stream.widen('#');
-  const Ch lbracket = stream.widen('[');
-  const Ch rbracket = stream.widen(']');
+bool ReadIni(std::basic_istream<char>& stream, StrStrMap& ini_content_tbl,
+             const IniReadContext& context) {
+  const std::string_view kIncludeDirective = "@include ";
+  // the ASCII whitespaces unless a locale is asked for.
+  auto trim = [&context](std::string_view str) {
+    return context.locale ? Trim(str, *context.locale) : Trim(str);
+  };
 
   std::string section;
-  Str line;
+  std::string line;
+  std::string combined_key;
+  std::string value_buffer;
+  std::string continued_value;
+  std::size_t line_number = 0;
+  std::uint64_t line_offset = 0;
+  std::size_t line_size = 0;
+  std::size_t indent = 0;
+  std::size_t key_count = 0;
+  std::set<std::string> seen_sections;
+  auto bound = [&context](std::size_t IniLimits::*field) {
+    auto value = context.limits ? context.limits->*field : 0;
+    return value ? value : std::numeric_limits<std::size_t>::max();
+  };
+  const std::size_t max_line = bound(&IniLimits::max_line_bytes);
+  const std::size_t max_keys = bound(&IniLimits::max_keys);
+  const std::size_t max_value = bound(&IniLimits::max_value_bytes);
+  const std::size_t max_total = bound(&IniLimits::max_total_bytes);
+  // no I/O: the problems are only recorded, when asked for.
+  auto report = [&](IniDiagnosticKind kind) {
+    if (context.diagnostics) {
+      context.diagnostics->Add({kind, static_cast<std::uint32_t>(line_number),
+                                static_cast<std::uint32_t>(indent + 1),
+                                line_offset + indent});
+    }
+  };
+  // checked as the lines are read, until the first ill-formed sequence.
+  bool check_utf8 = context.validate_utf8 && context.diagnostics;
+  // the next line, false past a bound: a line is never read past it.
+  auto next_line = [&]() {
+    bool fits = GetIniLine(stream, line, std::min(max_line, max_total));
+    ++line_number;
+    line_offset += line_size;
+    if (line_number == 1) {
+      auto bom = Utf8BomSize(line);
+      line.erase(0, bom);
+      line_offset += bom;
+    }
+    line_size = line.size() + 1;
+    if (check_utf8) {
+      auto pos = FindInvalidUtf8(line);
+      if (pos != std::string::npos) {
+        context.diagnostics->Add({IniDiagnosticKind::kInvalidUtf8,
+                                  static_cast<std::uint32_t>(line_number),
+                                  static_cast<std::uint32_t>(pos + 1),
+                                  line_offset + pos});
+        check_utf8 = false;
+      }
+    }
+    indent = 0;
+    if (line_offset + line.size() + (fits ? 0 : 1) > max_total) {
+      report(IniDiagnosticKind::kFileTooLarge);
+      return false;
+    }
+    if (!fits) {
+      report(IniDiagnosticKind::kLineTooLong);
+    }
+    return fits;
+  };
 
   // For all lines
   while (stream.good()) {
-    std::getline(stream, line);
+    if (!next_line()) {
+      return false;
+    }
     // "eof": true if an end-of-file has occurred, false otherwise.
     // "good": true if the stream error flags are all false, false otherwise.
     if (!stream.good() || stream.eof()) {
       break;
     }
     // If line is non-empty
-    line = Trim(line, stream.getloc());
-    if (line.empty()) {
+    std::string_view text = trim(line);
+    if (text.empty()) {
       continue;
     }
+    indent = static_cast<std::size_t>(text.data() - line.data());
     // Ignore comments
-    if (line[0] == semicolon || line[0] == hash) {
+    if (text[0] == ';' || text[0] == '#') {
+      continue;
+    }
+    if (text.compare(0, kIncludeDirective.size(), kIncludeDirective) == 0) {
+      if (context.includes) {
+        auto path = trim(text.substr(kIncludeDirective.size()));
+        context.includes->push_back({std::string(path), line_number});
+      }
       continue;
     }
 
     // section, key
-    if (line[0] == lbracket) {
-      typename Str::size_type end = line.find(rbracket);
-      if (end == Str::npos) {
-        std::cerr << "Unmatched '[' "
-                  << "\n";
+    if (text[0] == '[') {
+      auto end = text.find(']');
+      if (end == std::string_view::npos) {
+        report(IniDiagnosticKind::kUnmatchedBracket);
         continue;
       }
-      Str key = Trim(line.substr(1, end - 1), stream.getloc());
-      section = (key);
-      if (ini_content_tbl.find(section) != ini_content_tbl.end()) {
-        std::cerr << "Duplicated section name " << section << "\n";
+      auto key = trim(text.substr(1, end - 1));
+      // `[child : parent]` inherits the keys of `parent`.
+      auto colon = key.find(':');
+      if (colon != std::string_view::npos) {
+        auto parent = trim(key.substr(colon + 1));
+        key = trim(key.substr(0, colon));
+        if (context.parents && !parent.empty()) {
+          context.parents->insert_or_assign(std::string(key),
+                                            std::string(parent));
+        }
+      }
+      section.assign(key);
+      if (context.diagnostics && !seen_sections.insert(section).second) {
+        report(IniDiagnosticKind::kDuplicateSection);
       }
     } else {
       if (section.empty()) {
         // std::cout << " unmatched section " << "\n";
         continue;
       }
-      typename Str::size_type eq_pos = line.find(static_cast<Ch>('='));
-      if (eq_pos == Str::npos) {
-        std::cerr << "Unmatched '=' "
-                  << "\n";
+      auto eq_pos = text.find('=');
+      if (eq_pos == std::string_view::npos) {
+        report(IniDiagnosticKind::kMissingEquals);
         continue;
       }
       if (eq_pos == 0) {
-        std::cerr << "Unmatched key "
-                  << "\n";
+        report(IniDiagnosticKind::kEmptyKey);
         continue;
       }
-      Str key = Trim(line.substr(0, eq_pos), stream.getloc());
-      Str data = line.substr(eq_pos + 1, Str::npos);
-      auto pos = data.find_first_of(";#");
-      if (pos != Str::npos) {
-        data = Trim(data.substr(0, pos), stream.getloc());
-      } else {
-        data = Trim(data, stream.getloc());
+      if (++key_count > max_keys) {
+        report(IniDiagnosticKind::kTooManyKeys);
+        return false;
       }
-      std::string combined_key = section + std::string(".") + std::string(key);
-      if (ini_content_tbl.find(combined_key) != ini_content_tbl.end()) {
-        std::cerr << "Duplicated key name " << combined_key << "\n";
+      auto key = trim(text.substr(0, eq_pos));
+      combined_key.assign(section).append(1, '.').append(key);
+      if (context.diagnostics &&
+          ini_content_tbl.find(combined_key) != ini_content_tbl.end()) {
+        report(IniDiagnosticKind::kDuplicateKey);
+      }
+      if (context.key_lines) {
+        context.key_lines->insert_or_assign(combined_key, line_number);
+      }
+      auto token = ScanIniValue(text.substr(eq_pos + 1), value_buffer);
+      if (token.unterminated) {
+        report(IniDiagnosticKind::kUnterminatedQuote);
+      }
+      std::string_view data = token.value;
+      if (token.continued) {
+        // the next lines are read here, `text` and `key` are gone after.
+        continued_value.assign(data);
+        while (token.continued && stream.good() &&
+               continued_value.size() <= max_value) {
+          if (!next_line()) {
+            return false;
+          }
+          if (stream.fail()) {
+            break;
+          }
+          token = ScanIniValue(line, value_buffer);
+          continued_value.append(token.value);
+        }
+        data = continued_value;
+      }
+      if (data.size() > max_value) {
+        report(IniDiagnosticKind::kValueTooLarge);
+        return false;
+      }
+      if (context.pool) {
+        ini_content_tbl.insert_or_assign(context.pool->Intern(combined_key),
+                                         context.pool->Intern(data));
+      } else {
+        ini_content_tbl.insert_or_assign(combined_key, data);
       }
-      ini_content_tbl.insert_or_assign(combined_key, (data));
     }
   }
+  return true;
 }
 
 #endif  // INCLUDE_SETTINGS_H_
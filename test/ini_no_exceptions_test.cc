@@ -0,0 +1,46 @@
+// Built with `-fno-exceptions`: the header must compile and the `Try*`
+// interfaces must report every error without throwing.
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+
+#include "settings.h"
+
+constexpr const char no_exceptions_ini_file[] =
+    "/tmp/ini_no_exceptions_test_1.ini";
+
+class IniNoExceptionsTest : public ::testing::Test {
+ protected:
+  using TestIniSettings = Settings<no_exceptions_ini_file>;
+  void SetUp() override { std::filesystem::remove(no_exceptions_ini_file); }
+  void TearDown() override { std::filesystem::remove(no_exceptions_ini_file); }
+};
+
+TEST_F(IniNoExceptionsTest, try_get_value) {
+  auto& settings = TestIniSettings::GetInstance();
+  EXPECT_EQ(settings.TryGetValue<int>("main.workers").error(),
+            IniErrc::kMissing);
+
+  std::ofstream file(no_exceptions_ini_file);
+  file << "[main]\nworkers = 8\nname = ini\nratio = abc\nsmall = 300\n\n";
+  file.close();
+
+  auto workers = settings.TryGetValue<int>("main.workers");
+  ASSERT_TRUE(workers);
+  EXPECT_EQ(*workers, 8);
+  EXPECT_EQ(settings.TryGetValue<std::string>("main.name").value(), "ini");
+  EXPECT_EQ(settings.TryGetValue<double>("main.ratio").error(),
+            IniErrc::kMalformed);
+  EXPECT_EQ(settings.TryGetValue<int8_t>("main.small").error(),
+            IniErrc::kOutOfRange);
+  EXPECT_EQ(settings.TryGetValue<int>("main.none").value_or(3), 3);
+
+  settings.SetValue<int>("main.workers", 16);
+  EXPECT_EQ(settings.TryGetValue<int>("main.workers").value_or(0), 16);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -3,8 +3,10 @@
 #include <atomic>
 #include <chrono>
 #include <filesystem>
+#include <future>
 #include <thread>
 
+#include "ini_test_defaults.h"
 #include "settings.h"
 
 // it has a unique address across all translation units, and can be used as a
@@ -24,9 +26,22 @@ class IniSettingsTest : public ::testing::Test {
 
   void TearDown() override {
     auto file_path = TestIniSettings::GetInstance().GetFullPath();
-    if (std::filesystem::exists(file_path)) {
-      std::filesystem::remove(file_path);
-    }
+    TestIniSettings::GetInstance().ClearConstraints();
+    TestIniSettings::GetInstance().SetInterpolation(false);
+    TestIniSettings::GetInstance().SetLazySections(false);
+    TestIniSettings::GetInstance().SetMemoryBudget(0);
+    TestIniSettings::GetInstance().SetPreserveFormat(false);
+    TestIniSettings::GetInstance().SetCaseInsensitive(false);
+    TestIniSettings::GetInstance().SetValidateUtf8(false);
+    TestIniSettings::GetInstance().SetLimits({});
+    TestIniSettings::GetInstance().SetBaseLayer({});
+    TestIniSettings::GetInstance().SetDiagnostics(64);
+    TestIniSettings::GetInstance().SetHistory(0);
+    // the singleton outlives the test: load an empty file so the next test
+    // starts from an empty table. The options above force the reload.
+    WriteIniFileContent("");
+    TestIniSettings::GetInstance().GetValue<std::string>("main.key1");
+    std::filesystem::remove(file_path);
     // DestroyInstance
     TestIniSettings::DestroyInstance();
   }
@@ -298,6 +313,140 @@ routes.item1.gw = 172.23.1.2
 routes.item1.metric = 1
 )";
 
+TEST_F(IniSettingsTest, reload_without_blocking_readers) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent("[main]\nkey = 1\n");
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+
+  // the diagnostic of the bad line holds the reload in the middle of the
+  // parse, without the lock.
+  std::promise<void> parsing;
+  std::promise<void> resume;
+  auto resumed = resume.get_future().share();
+  settings.SetDiagnostics(8, [&](const IniDiagnostic&) {
+    parsing.set_value();
+    resumed.wait();
+  });
+  WriteIniFileContent("[main]\nkey = 2\nbad line\n");
+  auto reload = std::async(std::launch::async, [&]() {
+    return settings.GetValue<int>("main.key");
+  });
+  parsing.get_future().wait();
+  // the other readers keep the previous table meanwhile.
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+  resume.set_value();
+  EXPECT_EQ(reload.get(), 2);
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 2);
+  EXPECT_EQ(settings.Diagnostics().entries.size(), 1);
+}
+
+TEST_F(IniSettingsTest, write_without_blocking_readers) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent("[main]\nkey = 1\n");
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+
+  // the reload before the write is held in the middle of the parse.
+  std::promise<void> parsing;
+  std::promise<void> resume;
+  auto resumed = resume.get_future().share();
+  std::atomic<bool> held = {false};
+  settings.SetDiagnostics(8, [&](const IniDiagnostic&) {
+    if (!held.exchange(true)) {
+      parsing.set_value();
+      resumed.wait();
+    }
+  });
+  WriteIniFileContent("[main]\nkey = 2\nbad line\n");
+  auto write = std::async(std::launch::async, [&]() {
+    settings.SetValue<int>("main.other", 3);
+  });
+  parsing.get_future().wait();
+  // the readers keep the previous table meanwhile.
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+  resume.set_value();
+  write.get();
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 2);
+  EXPECT_EQ(settings.GetValue<int>("main.other"), 3);
+  // the file was replaced as a whole.
+  EXPECT_FALSE(std::filesystem::exists(settings.GetFullPath() + ".tmp"));
+}
+
+TEST_F(IniSettingsTest, read_snapshots) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent("[main]\nkey = 1\nname = a\n");
+  auto before = settings.Snapshot();
+  settings.SetValue<int>("main.key", 2);
+  settings.SetValue<int>("main.extra", 3);
+  auto after = settings.Snapshot();
+  // a snapshot is never changed by the later writes.
+  ASSERT_EQ(before.size(), 2);
+  EXPECT_EQ(*before.Find("main.key"), "1");
+  EXPECT_EQ(before.Find("main.extra"), nullptr);
+  EXPECT_EQ(*after.Find("main.key"), "2");
+  EXPECT_EQ(*after.Find("main.extra"), "3");
+  EXPECT_EQ(*after.Find("main.name"), "a");
+}
+
+TEST_F(IniSettingsTest, rollback_versions) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetHistory(3);
+  WriteIniFileContent("[main]\nkey = 1\n");
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+  auto good = settings.Generation();
+  settings.SetValue<int>("main.key", 2);
+  settings.SetValue<int>("main.key", 3);
+  auto versions = settings.Versions();
+  ASSERT_EQ(versions.size(), 3);
+  EXPECT_EQ(versions.front().version, good);
+  EXPECT_EQ(*versions.back().snapshot.Find("main.key"), "3");
+
+  EXPECT_EQ(settings.Rollback(good), IniErrc::kOk);
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 1);
+  // the rollback is a version too, and the oldest one is dropped.
+  ASSERT_EQ(settings.Versions().size(), 3);
+  EXPECT_EQ(settings.Rollback(good), IniErrc::kMissing);
+
+  EXPECT_EQ(settings.Rollback(settings.Versions().front().version, true),
+            IniErrc::kOk);
+  EXPECT_EQ(settings.GetValue<int>("main.key"), 2);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_EQ(content, "[main]\nkey=2\n");
+}
+
+TEST_F(IniSettingsTest, read_registered_keys) {
+  auto& settings = TestIniSettings::GetInstance();
+  auto workers = settings.Register("plugin.workers");
+  auto name = settings.Register("plugin.name");
+  EXPECT_EQ(settings.Register("plugin.workers"), workers);
+  EXPECT_EQ(settings.Get<int>(workers, 1), 1);
+
+  WriteIniFileContent("[plugin]\nworkers = 4\nname = p1\n");
+  EXPECT_EQ(settings.Get<int>(workers, 1), 4);
+  EXPECT_EQ(settings.Get<std::string>(name), "p1");
+  settings.SetValue<int>("plugin.workers", 6);
+  EXPECT_EQ(settings.Get<int>(workers, 1), 6);
+  // a key registered late is bound at once.
+  auto late = settings.Register("plugin.late");
+  WriteIniFileContent("[plugin]\nname = p2\nlate = yes\n");
+  // `Get` doesn't check the file, the other reads and `Refresh` do.
+  EXPECT_EQ(settings.Get<std::string>(name), "p1");
+  EXPECT_EQ(settings.Refresh(), IniErrc::kOk);
+  EXPECT_EQ(settings.Get<int>(workers, 1), 1);
+  EXPECT_EQ(settings.Get<std::string>(name), "p2");
+  EXPECT_EQ(settings.Get<bool>(late), true);
+  EXPECT_EQ(settings.Get<int>(late + 1, 7), 7);
+  // a slot read as several types converts to each of them.
+  WriteIniFileContent("[plugin]\nworkers = 8\n");
+  EXPECT_EQ(settings.GetValue<int>("plugin.workers", 1), 8);
+  EXPECT_EQ(settings.Get<int>(workers, 1), 8);
+  EXPECT_EQ(settings.Get<std::string>(workers), "8");
+  EXPECT_EQ(settings.Get<double>(workers), 8.0);
+  EXPECT_EQ(settings.Get<int>(workers, 1), 8);
+}
+
 TEST_F(IniSettingsTest, read_network_config) {
   WriteIniFileContent(network_ini_content);
   auto& settings = TestIniSettings::GetInstance();
@@ -349,6 +498,603 @@ TEST_F(IniSettingsTest, read_network_config_with_comment) {
             << std::endl;
 }
 
+enum class Mode { kActive, kStandby };
+template <>
+struct EnumNames<Mode> {
+  static constexpr std::pair<std::string_view, Mode> kNames[] = {
+      {"active", Mode::kActive}, {"standby", Mode::kStandby}};
+};
+
+TEST_F(IniSettingsTest, read_write_extended_types) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetValue<int64_t>("limits.max_bytes", 8589934592LL);
+  settings.SetValue<uint16_t>("limits.port", 65535);
+  settings.SetValue<Mode>("limits.mode", Mode::kStandby);
+  settings.SetValue<std::chrono::seconds>("limits.timeout",
+                                          std::chrono::seconds(30));
+
+  EXPECT_EQ(settings.GetValue<int64_t>("limits.max_bytes"), 8589934592LL);
+  EXPECT_EQ(settings.GetValue<uint16_t>("limits.port"), 65535);
+  EXPECT_EQ(settings.GetValue<std::string>("limits.mode"), "standby");
+  EXPECT_EQ(settings.GetValue<Mode>("limits.mode"), Mode::kStandby);
+  EXPECT_EQ(settings.GetValue<std::chrono::seconds>("limits.timeout"),
+            std::chrono::seconds(30));
+  EXPECT_EQ(settings.GetValue<std::optional<int>>("limits.none"),
+            std::nullopt);
+  EXPECT_THROW(settings.GetValue<uint8_t>("limits.port"), std::out_of_range);
+}
+
+// values that read leniently before the `ValueTraits` conversions.
+TEST_F(IniSettingsTest, read_values_strictly) {
+  WriteIniFileContent(
+      "[main]\nflag = maybe\nloud = on\ncaps = TRUE\ncount = 12abc\n");
+  auto& settings = TestIniSettings::GetInstance();
+  EXPECT_THROW(settings.GetValue<bool>("main.flag"), std::invalid_argument);
+  EXPECT_EQ(settings.TryGetValue<bool>("main.flag").error(),
+            IniErrc::kMalformed);
+  EXPECT_EQ(settings.GetValue<bool>("main.loud"), true);
+  EXPECT_EQ(settings.GetValue<bool>("main.caps"), true);
+  EXPECT_THROW(settings.GetValue<int>("main.count"), std::invalid_argument);
+  EXPECT_EQ(settings.TryGetValue<int>("main.count").error(),
+            IniErrc::kMalformed);
+}
+
+TEST_F(IniSettingsTest, read_cached_list) {
+  WriteIniFileContent(R"(
+[cluster]
+ports = 80, 443,8080
+servers = a:1,b:2,c:3
+)");
+  auto& settings = TestIniSettings::GetInstance();
+  auto ports = settings.GetList<uint16_t>("cluster.ports");
+  ASSERT_EQ(ports->size(), 3);
+  EXPECT_EQ((*ports)[0], 80);
+  EXPECT_EQ((*ports)[1], 443);
+  EXPECT_EQ((*ports)[2], 8080);
+  auto servers = settings.GetList<std::string>("cluster.servers");
+  ASSERT_EQ(servers->size(), 3);
+  EXPECT_EQ((*servers)[1], "b:2");
+  EXPECT_TRUE(settings.GetList<int>("cluster.none")->empty());
+  EXPECT_THROW(settings.GetList<int>("cluster.servers"),
+               std::invalid_argument);
+
+  // parsed once per generation
+  auto generation = settings.Generation();
+  EXPECT_EQ(settings.GetList<uint16_t>("cluster.ports"), ports);
+  EXPECT_NE(settings.GetList<std::string>("cluster.ports"), nullptr);
+  EXPECT_EQ(settings.GetList<std::string>("cluster.servers", ":,")->size(), 6);
+
+  // a change publishes a new list, the old one stays valid.
+  settings.SetValue<std::string>("cluster.ports", "1,2");
+  EXPECT_GT(settings.Generation(), generation);
+  auto new_ports = settings.GetList<uint16_t>("cluster.ports");
+  EXPECT_NE(new_ports, ports);
+  EXPECT_EQ(new_ports->size(), 2);
+  EXPECT_EQ(ports->size(), 3);
+}
+
+TEST_F(IniSettingsTest, read_size_and_duration) {
+  WriteIniFileContent(R"(
+[limits]
+buffer = 64MiB
+quota = 1.5GB
+timeout = 250ms
+ttl = 2h
+bad = 12 apples
+)");
+  auto& settings = TestIniSettings::GetInstance();
+  EXPECT_EQ(settings.GetBytes("limits.buffer"), 64ULL << 20);
+  EXPECT_EQ(settings.GetBytes("limits.quota"), 1500000000ULL);
+  EXPECT_EQ(settings.GetBytes("limits.none", 42), 42);
+  EXPECT_EQ(settings.GetDuration("limits.timeout"),
+            std::chrono::milliseconds(250));
+  EXPECT_EQ(settings.GetDuration<std::chrono::seconds>("limits.ttl"),
+            std::chrono::hours(2));
+  EXPECT_EQ(settings.GetDuration("limits.none", std::chrono::milliseconds(5)),
+            std::chrono::milliseconds(5));
+  EXPECT_THROW(settings.GetBytes("limits.bad"), std::invalid_argument);
+
+  settings.SetValue<ByteSize>("limits.buffer", ByteSize{1ULL << 30});
+  EXPECT_EQ(settings.GetValue<std::string>("limits.buffer"), "1GiB");
+  EXPECT_EQ(settings.GetBytes("limits.buffer"), 1ULL << 30);
+}
+
+TEST_F(IniSettingsTest, validate_at_load) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.AddConstraint("main.workers", IniConstraint::Range(1, 256));
+  settings.AddConstraint("main.mode", IniConstraint::OneOf({"fast", "safe"}));
+  settings.AddConstraint("main.host", IniConstraint::Pattern("db-??.*"));
+  settings.AddConstraint(
+      "main.name", IniConstraint::Predicate("non-numeric", [](auto value) {
+        return value.find_first_of("0123456789") == std::string_view::npos;
+      }));
+  settings.AddConstraint("main.queue", IniConstraint::Range<int>(
+                                           1, 100, IniConstraintAction::kClamp));
+
+  WriteIniFileContent(R"(
+[main]
+workers = 512
+mode = fast
+host = db-01.local
+name = ini
+queue = 1000
+)");
+  // rejected: nothing was ever published.
+  EXPECT_EQ(settings.GetValue<int>("main.workers", 4), 4);
+  auto violations = settings.Violations();
+  ASSERT_EQ(violations.size(), 1);
+  EXPECT_EQ(violations[0].key, "main.workers");
+  EXPECT_EQ(violations[0].value, "512");
+  EXPECT_EQ(violations[0].constraint, "range [1, 256]");
+
+  WriteIniFileContent(R"(
+[main]
+workers = 16
+mode = fast
+host = db-01.local
+name = ini
+queue = 1000
+)");
+  EXPECT_EQ(settings.GetValue<int>("main.workers", 4), 16);
+  EXPECT_EQ(settings.GetValue<int>("main.queue"), 100);
+  EXPECT_TRUE(settings.Violations().empty());
+
+  // a broken file keeps the previous good table.
+  WriteIniFileContent(R"(
+[main]
+workers = 0
+mode = slow
+host = web-01
+name = ini2
+)");
+  EXPECT_EQ(settings.GetValue<int>("main.workers", 4), 16);
+  EXPECT_EQ(settings.GetValue<std::string>("main.mode"), "fast");
+  EXPECT_EQ(settings.Violations().size(), 4);
+  EXPECT_THROW(settings.SetValue<int>("main.workers", 8), std::runtime_error);
+
+  WriteIniFileContent(my_ini_content);
+  EXPECT_EQ(settings.GetValue<std::string>("string.key1"), "value11");
+  EXPECT_THROW(settings.SetValue<int>("main.workers", 300),
+               std::invalid_argument);
+  settings.SetValue<int>("main.queue", 300);
+  EXPECT_EQ(settings.GetValue<int>("main.queue"), 100);
+}
+
+TEST_F(IniSettingsTest, read_interpolated_values) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetInterpolation(true);
+  WriteIniFileContent(R"(
+[paths]
+root = /srv
+logs = ${root}/logs
+
+[app]
+log_dir = ${paths.logs}/app
+a = ${b}
+b = ${a}
+)");
+  // the cycle rejects the file.
+  EXPECT_EQ(settings.GetValue<std::string>("app.log_dir", "none"), "none");
+  auto violations = settings.Violations();
+  ASSERT_EQ(violations.size(), 2);
+  EXPECT_EQ(violations[0].constraint,
+            "interpolation cycle: app.a (line 8) -> app.b (line 9) -> app.a "
+            "(line 8)");
+
+  WriteIniFileContent(R"(
+[paths]
+root = /srv
+logs = ${root}/logs
+
+[app]
+log_dir = ${paths.logs}/app
+)");
+  EXPECT_EQ(settings.GetValue<std::string>("paths.logs"), "/srv/logs");
+  EXPECT_EQ(settings.GetValue<std::string>("app.log_dir"), "/srv/logs/app");
+
+  // the file keeps the references.
+  settings.SetValue<std::string>("paths.root", "/data");
+  EXPECT_EQ(settings.GetValue<std::string>("app.log_dir"), "/data/logs/app");
+  settings.SetInterpolation(false);
+  EXPECT_EQ(settings.GetValue<std::string>("app.log_dir"), "${paths.logs}/app");
+}
+
+TEST_F(IniSettingsTest, read_inherited_sections) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent(R"(
+[backend.default]
+timeout = 30s
+retries = 3
+region = us
+
+[backend.eu : backend.default]
+region = eu
+
+[backend.eu2 : backend.eu]
+retries = 5
+)");
+  EXPECT_EQ(settings.GetValue<std::string>("backend.eu.timeout"), "30s");
+  EXPECT_EQ(settings.GetValue<std::string>("backend.eu.region"), "eu");
+  EXPECT_EQ(settings.GetValue<int>("backend.eu2.retries"), 5);
+  EXPECT_EQ(settings.GetValue<std::string>("backend.eu2.region"), "eu");
+  EXPECT_EQ(settings.GetValue<std::string>("backend.eu2.timeout"), "30s");
+
+  // the file keeps the headers and only the keys it defines.
+  settings.SetValue<int>("backend.default.retries", 4);
+  EXPECT_EQ(settings.GetValue<int>("backend.eu.retries"), 4);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_NE(content.find("[backend.eu2 : backend.eu]"), std::string::npos);
+  EXPECT_EQ(content.find("eu2.timeout"), std::string::npos);
+  EXPECT_EQ(content.find("timeout"), content.rfind("timeout"));
+
+  // cycles reject the file.
+  WriteIniFileContent(R"(
+[a : b]
+x = 1
+[b : a]
+y = 2
+)");
+  EXPECT_EQ(settings.GetValue<int>("backend.eu.retries"), 4);
+  auto violations = settings.Violations();
+  ASSERT_EQ(violations.size(), 2);
+  EXPECT_EQ(violations[0].constraint, "inheritance cycle: a -> b -> a");
+}
+
+TEST_F(IniSettingsTest, read_lazy_sections) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetLazySections(true);
+  WriteIniFileContent(R"(
+[net]
+mtu = 1500
+[db.primary]
+host = db-01
+[log]
+level = info
+[net]
+mtu = 9000
+vlan = 7
+)");
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 9000);
+  EXPECT_EQ(settings.GetValue<int>("net.vlan"), 7);
+  EXPECT_EQ(settings.PendingSections(), 2);
+  EXPECT_EQ(settings.GetValue<std::string>("db.primary.host"), "db-01");
+  EXPECT_EQ(settings.GetValue<std::string>("db.primary.port", "none"), "none");
+  EXPECT_EQ(settings.PendingSections(), 1);
+
+  // writes keep the sections that were never read.
+  settings.SetValue<int>("net.mtu", 1400);
+  EXPECT_EQ(settings.PendingSections(), 0);
+  WriteIniFileContent(R"(
+[log]
+level = debug
+[net]
+mtu = 1500
+)");
+  EXPECT_EQ(settings.GetValue<std::string>("log.level"), "debug");
+  EXPECT_EQ(settings.PendingSections(), 1);
+
+  // constraints need the whole file.
+  settings.AddConstraint("net.mtu", IniConstraint::Range(576, 9000));
+  EXPECT_EQ(settings.GetValue<std::string>("log.level"), "debug");
+  EXPECT_EQ(settings.PendingSections(), 0);
+}
+
+TEST_F(IniSettingsTest, read_lazy_continued_values) {
+  auto& settings = TestIniSettings::GetInstance();
+  std::string content =
+      "[net]\nroutes = 10.0.0.0/8, \\\n[192.168.0.0]/16\nmtu = 1500\n[log]\n"
+      "level = info\n";
+  WriteIniFileContent(content);
+  auto eager = settings.Snapshot();
+  settings.SetLazySections(true);
+  WriteIniFileContent(content);
+  EXPECT_EQ(settings.GetValue<std::string>("net.routes"),
+            "10.0.0.0/8, [192.168.0.0]/16");
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 1500);
+  EXPECT_EQ(settings.GetValue<std::string>("log.level"), "info");
+  EXPECT_EQ(settings.PendingSections(), 0);
+  EXPECT_TRUE(Diff(eager, settings.Snapshot()).empty());
+}
+
+TEST_F(IniSettingsTest, read_lazy_sections_in_budget) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetLazySections(true);
+  std::string content;
+  for (const auto* section : {"a", "b", "c", "d"}) {
+    content += std::string("[") + section + "]\n";
+    for (int i = 0; i < 10; ++i) {
+      content += "key" + std::to_string(i) + " = " + section + "\n";
+    }
+  }
+  WriteIniFileContent(content);
+  EXPECT_EQ(settings.GetValue<std::string>("a.key0"), "a");
+  auto one_section = settings.MemoryStats().resident_bytes;
+  EXPECT_GT(one_section, 0);
+
+  // room for two sections.
+  settings.SetMemoryBudget(2 * one_section);
+  EXPECT_EQ(settings.GetValue<std::string>("b.key1"), "b");
+  EXPECT_EQ(settings.GetValue<std::string>("a.key2"), "a");
+  EXPECT_EQ(settings.GetValue<std::string>("c.key3"), "c");  // evicts b
+  auto stats = settings.MemoryStats();
+  EXPECT_EQ(stats.resident_sections, 2);
+  EXPECT_EQ(stats.pending_sections, 2);
+  EXPECT_EQ(stats.evictions, 1);
+  EXPECT_LE(stats.resident_bytes, 2 * one_section);
+
+  // evicted sections are parsed again from the file.
+  EXPECT_EQ(settings.GetValue<std::string>("b.key9"), "b");  // evicts a
+  EXPECT_EQ(settings.GetValue<std::string>("d.key9"), "d");  // evicts c
+  EXPECT_EQ(settings.MemoryStats().evictions, 3);
+  EXPECT_EQ(settings.GetValue<std::string>("a.key4", "none"), "a");
+
+  // writes keep every section.
+  settings.SetValue<std::string>("a.key0", "z");
+  EXPECT_EQ(settings.GetValue<std::string>("a.key0"), "z");
+  EXPECT_EQ(settings.GetValue<std::string>("c.key0"), "c");
+  EXPECT_EQ(settings.MemoryStats().resident_sections, 2);
+}
+
+TEST_F(IniSettingsTest, read_diagnostics) {
+  auto& settings = TestIniSettings::GetInstance();
+  std::vector<IniDiagnostic> sunk;
+  settings.SetDiagnostics(
+      1, [&](const IniDiagnostic& diagnostic) { sunk.push_back(diagnostic); });
+  WriteIniFileContent(R"(
+[net]
+mtu = 1500
+mtu = 9000
+vlan
+)");
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 9000);
+  auto diagnostics = settings.Diagnostics();
+  ASSERT_EQ(diagnostics.entries.size(), 1);
+  EXPECT_EQ(diagnostics.entries[0].kind, IniDiagnosticKind::kDuplicateKey);
+  EXPECT_EQ(diagnostics.entries[0].line, 4);
+  EXPECT_EQ(diagnostics.dropped, 1);
+  ASSERT_EQ(sunk.size(), 1);
+  settings.SetDiagnostics(64);
+}
+
+TEST_F(IniSettingsTest, read_utf8_with_bom) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetValidateUtf8(true);
+  WriteIniFileContent("\xEF\xBB\xBF[main]\nname = caf\xc3\xa9\nbad = \xfe\n");
+  EXPECT_EQ(settings.GetValue<std::string>("main.name"), "caf\xc3\xa9");
+  auto diagnostics = settings.Diagnostics();
+  ASSERT_EQ(diagnostics.entries.size(), 1);
+  EXPECT_EQ(diagnostics.entries[0].kind, IniDiagnosticKind::kInvalidUtf8);
+  EXPECT_EQ(diagnostics.entries[0].line, 3);
+  EXPECT_EQ(diagnostics.entries[0].offset, 29);
+}
+
+TEST_F(IniSettingsTest, read_with_limits) {
+  auto& settings = TestIniSettings::GetInstance();
+  IniLimits limits;
+  limits.max_keys = 2;
+  settings.SetLimits(limits);
+  WriteIniFileContent("[main]\na = 1\nb = 2\n");
+  EXPECT_EQ(settings.GetValue<int>("main.b"), 2);
+
+  // a file past a bound keeps serving the previous table.
+  WriteIniFileContent("[main]\na = 3\nb = 4\nc = 5\n");
+  EXPECT_EQ(settings.GetValue<int>("main.b"), 2);
+  EXPECT_EQ(settings.TryGetValue<int>("main.c").error(), IniErrc::kMissing);
+  ASSERT_EQ(settings.Violations().size(), 1);
+  ASSERT_EQ(settings.Diagnostics().entries.size(), 1);
+  EXPECT_EQ(settings.Diagnostics().entries[0].kind,
+            IniDiagnosticKind::kTooManyKeys);
+  EXPECT_EQ(settings.Diagnostics().entries[0].line, 4);
+
+  // nor may it include other files, which would not be bounded.
+  WriteIniFileContent("@include /dev/zero\n[main]\na = 7\n");
+  EXPECT_EQ(settings.GetValue<int>("main.a"), 1);
+  auto violations = settings.Violations();
+  ASSERT_EQ(violations.size(), 1);
+  EXPECT_EQ(violations[0].key, "@include");
+  EXPECT_EQ(violations[0].value, "/dev/zero");
+}
+
+TEST_F(IniSettingsTest, read_embedded_base_layer) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetBaseLayer(ini_test_defaults);
+  // without the file, the embedded defaults alone.
+  EXPECT_EQ(settings.GetValue<int>("main.workers"), 4);
+  EXPECT_EQ(settings.GetValue<std::string>("edge.name"), "edge #1");
+  EXPECT_EQ(settings.GetValue<int>("edge.mtu"), 1500);
+
+  WriteIniFileContent("[main]\nworkers = 8\n[edge]\nmtu = 9000\n");
+  EXPECT_EQ(settings.GetValue<int>("main.workers"), 8);
+  EXPECT_EQ(settings.GetValue<std::string>("main.mode"), "safe");
+  EXPECT_EQ(settings.GetValue<int>("edge.mtu"), 9000);
+
+  // the file only stores its own keys.
+  settings.SetValue<int>("net.mtu", 1400);
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 1400);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_EQ(content.find("mode"), std::string::npos);
+  EXPECT_NE(content.find("mtu=1400"), std::string::npos);
+}
+
+TEST_F(IniSettingsTest, write_lazy_sections_with_base_layer) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetBaseLayer(ini_test_defaults);
+  settings.SetLazySections(true);
+  WriteIniFileContent("[b]\nk1 = 1\nk2 = 2\nk3 = 3\n");
+  // a base layer loads the file at once.
+  EXPECT_EQ(settings.GetValue<int>("main.workers"), 4);
+  EXPECT_EQ(settings.PendingSections(), 0);
+  settings.SetValue<int>("b.k4", 4);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_NE(content.find("k1=1"), std::string::npos);
+  EXPECT_NE(content.find("k3=3"), std::string::npos);
+  EXPECT_NE(content.find("k4=4"), std::string::npos);
+  EXPECT_EQ(settings.GetValue<int>("b.k2"), 2);
+  EXPECT_EQ(settings.GetValue<int>("main.workers"), 4);
+}
+
+TEST_F(IniSettingsTest, write_preserving_format) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetPreserveFormat(true);
+  WriteIniFileContent(R"(; maintained by the operators
+[server]
+workers = 8   ; one per core
+
+[client]
+timeout = 30s
+)");
+  settings.SetValue<int>("server.workers", 16);
+  settings.SetValue<std::string>("client.retries", "3");
+  EXPECT_EQ(settings.GetValue<int>("server.workers"), 16);
+  EXPECT_EQ(settings.GetValue<int>("client.retries"), 3);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_EQ(content, R"(; maintained by the operators
+[server]
+workers = 16   ; one per core
+
+[client]
+timeout = 30s
+retries = 3
+)");
+}
+
+TEST_F(IniSettingsTest, read_write_quoted_values) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent(R"(
+[db]
+password = "p#ss;word"  ; quoted
+url = https://host/path\#frag
+hosts = db-01, \
+        db-02
+)");
+  EXPECT_EQ(settings.GetValue<std::string>("db.password"), "p#ss;word");
+  EXPECT_EQ(settings.GetValue<std::string>("db.url"), "https://host/path#frag");
+  EXPECT_EQ(settings.GetValue<std::string>("db.hosts"), "db-01, db-02");
+
+  // written values read back as is.
+  settings.SetValue<std::string>("db.comment", " #1; ok ");
+  EXPECT_EQ(settings.GetValue<std::string>("db.comment"), " #1; ok ");
+  EXPECT_EQ(settings.GetValue<std::string>("db.password"), "p#ss;word");
+}
+
+TEST_F(IniSettingsTest, read_write_case_insensitive_keys) {
+  auto& settings = TestIniSettings::GetInstance();
+  WriteIniFileContent(R"(
+[Network]
+MTU = 1500
+[Server : Network]
+Name = edge-01
+)");
+  EXPECT_EQ(settings.GetValue<int>("network.mtu"), 0);
+  settings.SetCaseInsensitive(true);
+  EXPECT_EQ(settings.GetValue<int>("network.mtu"), 1500);
+  EXPECT_EQ(settings.GetValue<int>("NETWORK.Mtu"), 1500);
+  EXPECT_EQ(settings.GetValue<int>("server.mtu"), 1500);
+  EXPECT_EQ(settings.GetValue<std::string>("SERVER.NAME"), "edge-01");
+
+  // the file keeps its spelling of the written key.
+  settings.SetValue<int>("network.mtu", 9000);
+  EXPECT_EQ(settings.GetValue<int>("Network.MTU"), 9000);
+  settings.SetCaseInsensitive(false);
+  EXPECT_EQ(settings.GetValue<int>("Network.MTU"), 9000);
+  EXPECT_EQ(settings.GetValue<int>("network.mtu"), 0);
+}
+
+TEST_F(IniSettingsTest, write_new_key_case_insensitive) {
+  auto& settings = TestIniSettings::GetInstance();
+  settings.SetCaseInsensitive(true);
+  settings.SetPreserveFormat(true);
+  WriteIniFileContent("[Network]\nMTU = 1500\n");
+  // a new key goes to the section as the file spells it.
+  settings.SetValue<int>("network.timeout", 30);
+  EXPECT_EQ(settings.GetValue<int>("Network.Timeout"), 30);
+  std::ifstream file(settings.GetFullPath());
+  std::string content((std::istreambuf_iterator<char>(file)),
+                      std::istreambuf_iterator<char>());
+  EXPECT_EQ(content, "[Network]\nMTU = 1500\ntimeout = 30\n");
+
+  // and without the format preserved.
+  settings.SetPreserveFormat(false);
+  settings.SetValue<int>("NETWORK.retries", 3);
+  settings.SetCaseInsensitive(false);
+  EXPECT_EQ(settings.GetValue<int>("Network.retries"), 3);
+  EXPECT_EQ(settings.GetValue<int>("Network.timeout"), 30);
+}
+
+constexpr const char include_ini_file[] = "/tmp/ini_include_test/main.ini";
+constexpr const char include_ini_file2[] = "/tmp/ini_include_test/other.ini";
+
+TEST(IniIncludeTest, read_included_files) {
+  using MainSettings = Settings<include_ini_file>;
+  using OtherSettings = Settings<include_ini_file2>;
+  auto write = [](const std::string& path, const std::string& content) {
+    std::ofstream file(path);
+    file << content;
+  };
+  std::filesystem::remove_all("/tmp/ini_include_test");
+  std::filesystem::create_directories("/tmp/ini_include_test/common");
+  write("/tmp/ini_include_test/common/base.ini",
+        "@include net.ini\n[db]\nhost = db-01\nport = 5432\n\n");
+  write("/tmp/ini_include_test/common/net.ini", "[net]\nmtu = 1500\n\n");
+  write(include_ini_file,
+        "@include common/base.ini\n[db]\nport = 6432\n[main]\nname = a\n\n");
+  write(include_ini_file2, "@include common/base.ini\n[main]\nname = b\n\n");
+
+  auto& settings = MainSettings::GetInstance();
+  auto parsed = IniIncludeCache::Instance().ParseCount();
+  EXPECT_EQ(settings.GetValue<std::string>("db.host"), "db-01");
+  EXPECT_EQ(settings.GetValue<int>("db.port"), 6432);
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 1500);
+  EXPECT_EQ(IniIncludeCache::Instance().ParseCount(), parsed + 2);
+
+  // shared by all the instances
+  auto& other = OtherSettings::GetInstance();
+  EXPECT_EQ(other.GetValue<int>("db.port"), 5432);
+  EXPECT_EQ(other.GetValue<std::string>("main.name"), "b");
+  EXPECT_EQ(IniIncludeCache::Instance().ParseCount(), parsed + 2);
+
+  // only the changed file is parsed again.
+  write("/tmp/ini_include_test/common/net.ini", "[net]\nmtu = 9000\n\n");
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 9000);
+  EXPECT_EQ(other.GetValue<int>("net.mtu"), 9000);
+  EXPECT_EQ(IniIncludeCache::Instance().ParseCount(), parsed + 3);
+
+  // concurrent loads of a changed include agree on its table.
+  write("/tmp/ini_include_test/common/net.ini", "[net]\nmtu = 576\n\n");
+  auto first = std::async(std::launch::async, [&settings]() {
+    return settings.GetValue<int>("net.mtu");
+  });
+  EXPECT_EQ(other.GetValue<int>("net.mtu"), 576);
+  EXPECT_EQ(first.get(), 576);
+
+  // the include directive survives a write.
+  settings.SetValue<std::string>("main.name", "c");
+  EXPECT_EQ(settings.GetValue<std::string>("main.name"), "c");
+  EXPECT_EQ(settings.GetValue<std::string>("db.host"), "db-01");
+  std::ifstream main_file(include_ini_file);
+  std::string first_line;
+  std::getline(main_file, first_line);
+  EXPECT_EQ(first_line, "@include common/base.ini");
+
+  // cycles reject the file.
+  write("/tmp/ini_include_test/common/net.ini",
+        "@include base.ini\n[net]\nmtu = 1\n\n");
+  EXPECT_EQ(settings.GetValue<int>("net.mtu"), 576);
+  auto violations = settings.Violations();
+  ASSERT_EQ(violations.size(), 1);
+  EXPECT_EQ(violations[0].key, "@include");
+  EXPECT_NE(violations[0].constraint.find("include cycle"), std::string::npos);
+  std::filesystem::remove_all("/tmp/ini_include_test");
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
 
 #include "settings.h"
 
@@ -30,6 +36,744 @@ TEST(IniSettings, ConvertValue_test) {
   // EXPECT_EQ(ConvertValue<char>("", 'a'), 'a');
 }
 
+enum class LogLevel { kDebug, kInfo, kError };
+template <>
+struct EnumNames<LogLevel> {
+  static constexpr std::pair<std::string_view, LogLevel> kNames[] = {
+      {"debug", LogLevel::kDebug},
+      {"info", LogLevel::kInfo},
+      {"error", LogLevel::kError}};
+};
+
+enum class Port : uint16_t {};
+
+struct Endpoint {
+  std::string host;
+  uint16_t port = 0;
+};
+template <>
+struct ValueTraits<Endpoint> {
+  static std::errc Parse(std::string_view text, Endpoint& out) {
+    auto pos = text.find(':');
+    if (pos == std::string_view::npos) {
+      return std::errc::invalid_argument;
+    }
+    out.host = std::string(text.substr(0, pos));
+    return ValueTraits<uint16_t>::Parse(text.substr(pos + 1), out.port);
+  }
+  static std::string Format(const Endpoint& value) {
+    return value.host + ":" + std::to_string(value.port);
+  }
+};
+
+TEST(IniSettings, ValueTraits_test) {
+  // integer widths
+  EXPECT_EQ(ConvertValue<int64_t>("9000000000", 0), 9000000000LL);
+  EXPECT_EQ(ConvertValue<uint64_t>("18446744073709551615", 0),
+            UINT64_MAX);
+  EXPECT_EQ(ConvertValue<uint32_t>("0xff", 0), 255U);
+  EXPECT_EQ(ConvertValue<int8_t>("+12", 0), 12);
+  EXPECT_THROW(ConvertValue<int8_t>("300", 0), std::out_of_range);
+  EXPECT_THROW(ConvertValue<uint16_t>("-1", 0), std::invalid_argument);
+  EXPECT_THROW(ConvertValue<int>("12abc", 0), std::invalid_argument);
+  // one sign at most, and none after the `0x` prefix
+  EXPECT_EQ(TryConvertValue<int>("-0x5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<int>("+-5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<int>("0x-5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<int>("0x+5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<int>("++5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<uint32_t>("+-5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<uint32_t>("0x-5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<double>("+-5").error(), IniErrc::kMalformed);
+  EXPECT_EQ(ConvertValue<int>("-5", 0), -5);
+  EXPECT_EQ(ValueTraits<int64_t>::Format(INT64_MIN), "-9223372036854775808");
+
+  // bool spellings
+  EXPECT_EQ(ConvertValue<bool>("TRUE", false), true);
+  EXPECT_EQ(ConvertValue<bool>("on", false), true);
+  EXPECT_EQ(ConvertValue<bool>("No", true), false);
+  EXPECT_THROW(ConvertValue<bool>("maybe", false), std::invalid_argument);
+
+  // enums, by name and by underlying value
+  EXPECT_EQ(ConvertValue<LogLevel>("error", LogLevel::kDebug),
+            LogLevel::kError);
+  EXPECT_EQ(ConvertValue<LogLevel>("1", LogLevel::kDebug), LogLevel::kInfo);
+  EXPECT_EQ(ValueTraits<LogLevel>::Format(LogLevel::kInfo), "info");
+  EXPECT_EQ(ConvertValue<Port>("8080", Port{}), Port{8080});
+  EXPECT_EQ(ValueTraits<Port>::Format(Port{443}), "443");
+
+  // durations are a count of the period
+  EXPECT_EQ(ConvertValue<std::chrono::milliseconds>(
+                "250", std::chrono::milliseconds(0)),
+            std::chrono::milliseconds(250));
+  EXPECT_EQ(ValueTraits<std::chrono::seconds>::Format(std::chrono::seconds(3)),
+            "3s");
+
+  // optional
+  EXPECT_EQ(ConvertValue<std::optional<int>>("", std::nullopt), std::nullopt);
+  EXPECT_EQ(ConvertValue<std::optional<int>>("7", std::nullopt), 7);
+  EXPECT_EQ(ValueTraits<std::optional<int>>::Format(std::nullopt), "");
+
+  // user defined type
+  auto ep = ConvertValue<Endpoint>("localhost:80", Endpoint{});
+  EXPECT_EQ(ep.host, "localhost");
+  EXPECT_EQ(ep.port, 80);
+  EXPECT_EQ(ValueTraits<Endpoint>::Format(ep), "localhost:80");
+
+  static_assert(is_supported_value<Endpoint>::value);
+  static_assert(!is_supported_value<std::vector<int>>::value);
+  static_assert(!is_supported_value<char*>::value);
+}
+
+TEST(IniSettings, ParseByteSize_test) {
+  std::uint64_t bytes = 0;
+  EXPECT_EQ(ParseByteSize("512", bytes), std::errc{});
+  EXPECT_EQ(bytes, 512);
+  EXPECT_EQ(ParseByteSize("64MiB", bytes), std::errc{});
+  EXPECT_EQ(bytes, 64ULL << 20);
+  EXPECT_EQ(ParseByteSize("1.5GB", bytes), std::errc{});
+  EXPECT_EQ(bytes, 1500000000ULL);
+  EXPECT_EQ(ParseByteSize("2 tib", bytes), std::errc{});
+  EXPECT_EQ(bytes, 2ULL << 40);
+  EXPECT_EQ(ParseByteSize("4k", bytes), std::errc{});
+  EXPECT_EQ(bytes, 4000);
+  EXPECT_EQ(ParseByteSize("10B", bytes), std::errc{});
+  EXPECT_EQ(bytes, 10);
+  EXPECT_EQ(ParseByteSize("MiB", bytes), std::errc::invalid_argument);
+  EXPECT_EQ(ParseByteSize("12 apples", bytes), std::errc::invalid_argument);
+  EXPECT_EQ(ParseByteSize("-1KiB", bytes), std::errc::invalid_argument);
+  EXPECT_EQ(ParseByteSize("99999999PiB", bytes),
+            std::errc::result_out_of_range);
+
+  EXPECT_EQ(ValueTraits<ByteSize>::Format(ByteSize{64ULL << 20}), "64MiB");
+  EXPECT_EQ(ValueTraits<ByteSize>::Format(ByteSize{1000}), "1000");
+  EXPECT_EQ(ValueTraits<ByteSize>::Format(ByteSize{0}), "0");
+}
+
+TEST(IniSettings, ParseDuration_test) {
+  using std::chrono::nanoseconds;
+  nanoseconds ns{};
+  EXPECT_EQ(ParseDuration("250ms", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::milliseconds(250));
+  EXPECT_EQ(ParseDuration("2h", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::hours(2));
+  EXPECT_EQ(ParseDuration("1h30m", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::minutes(90));
+  EXPECT_EQ(ParseDuration("1.5s", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::milliseconds(1500));
+  EXPECT_EQ(ParseDuration("10us", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::microseconds(10));
+  EXPECT_EQ(ParseDuration("1d", ns), std::errc{});
+  EXPECT_EQ(ns, std::chrono::hours(24));
+  EXPECT_EQ(ParseDuration("5", ns), std::errc::invalid_argument);
+  EXPECT_EQ(ParseDuration("5 parsecs", ns), std::errc::invalid_argument);
+  EXPECT_EQ(ParseDuration("", ns), std::errc::invalid_argument);
+  EXPECT_EQ(ParseDuration("999999d", ns), std::errc::result_out_of_range);
+
+  // the duration traits accept both units and plain counts.
+  EXPECT_EQ(ConvertValue<std::chrono::seconds>("2m", std::chrono::seconds(0)),
+            std::chrono::seconds(120));
+  EXPECT_EQ(ConvertValue<std::chrono::seconds>("2", std::chrono::seconds(0)),
+            std::chrono::seconds(2));
+  EXPECT_EQ(ValueTraits<std::chrono::milliseconds>::Format(
+                std::chrono::milliseconds(250)),
+            "250ms");
+}
+
+TEST(IniSettings, TryConvertValue_test) {
+  auto value = TryConvertValue<int>("42");
+  ASSERT_TRUE(value.has_value());
+  EXPECT_EQ(*value, 42);
+  EXPECT_EQ(value.error(), IniErrc::kOk);
+  EXPECT_EQ(TryConvertValue<int>("").error(), IniErrc::kMissing);
+  EXPECT_EQ(TryConvertValue<int>("4x2").error(), IniErrc::kMalformed);
+  EXPECT_EQ(TryConvertValue<uint8_t>("256").error(), IniErrc::kOutOfRange);
+  EXPECT_EQ(TryConvertValue<bool>("maybe").value_or(true), true);
+  EXPECT_STREQ(IniErrcMessage(IniErrc::kOutOfRange), "out of range");
+
+  // a value of a type that converts from `IniErrc` is still a value.
+  IniExpected<IniErrc> errc = IniErrc::kInvalid;
+  ASSERT_TRUE(errc.has_value());
+  EXPECT_EQ(*errc, IniErrc::kInvalid);
+  IniExpected<IniErrc> error = IniUnexpected(IniErrc::kIoError);
+  EXPECT_FALSE(error.has_value());
+  EXPECT_EQ(error.error(), IniErrc::kIoError);
+  static_assert(!std::is_convertible<IniErrc, IniExpected<int>>::value,
+                "an error needs IniUnexpected");
+}
+
+TEST(IniSettings, GlobMatch_test) {
+  EXPECT_TRUE(GlobMatch("*", ""));
+  EXPECT_TRUE(GlobMatch("db-??", "db-01"));
+  EXPECT_FALSE(GlobMatch("db-??", "db-1"));
+  EXPECT_TRUE(GlobMatch("*.example.com", "a.b.example.com"));
+  EXPECT_FALSE(GlobMatch("*.example.com", "example.com"));
+  EXPECT_TRUE(GlobMatch("/var/*/logs/*", "/var/app/logs/x.log"));
+  EXPECT_FALSE(GlobMatch("abc", "abcd"));
+}
+
+TEST(IniSettings, InterpolateTbl_test) {
+  setenv("INI_TEST_HOME", "/home/ini", 1);
+  StrStrMap raw = {{"paths.root", "/srv"},
+                   {"paths.logs", "${root}/logs"},
+                   {"app.log_dir", "${paths.logs}/app"},
+                   {"app.home", "${ENV:INI_TEST_HOME}/.app"},
+                   {"app.price", "$$5 ${app.missing}"},
+                   {"app.plain", "value"}};
+  StrStrMap resolved;
+  std::vector<IniViolation> violations;
+  EXPECT_EQ(InterpolateTbl(raw, {}, nullptr, nullptr, resolved, violations),
+            4);
+  EXPECT_TRUE(violations.empty());
+  EXPECT_EQ(resolved["paths.logs"], "/srv/logs");
+  EXPECT_EQ(resolved["app.log_dir"], "/srv/logs/app");
+  EXPECT_EQ(resolved["app.home"], "/home/ini/.app");
+  EXPECT_EQ(resolved["app.price"], "$5 ");
+  EXPECT_EQ(resolved["app.plain"], "value");
+
+  // only the dependents of a changed key are recomputed.
+  IniPersistentMap prev_resolved(resolved);
+  StrStrMap next_raw = raw;
+  next_raw["app.plain"] = "other";
+  StrStrMap next_resolved;
+  EXPECT_EQ(InterpolateTbl(next_raw, {}, &raw, &prev_resolved, next_resolved,
+                           violations),
+            2);  // the ENV and the missing references
+  next_raw["paths.root"] = "/data";
+  StrStrMap last_resolved;
+  EXPECT_EQ(InterpolateTbl(next_raw, {}, &raw, &prev_resolved, last_resolved,
+                           violations),
+            4);
+  EXPECT_EQ(last_resolved["app.log_dir"], "/data/logs/app");
+
+  // a reference to a removed key expands to nothing again.
+  StrStrMap with_y = {{"a.x", "${y}"}, {"a.y", "1"}};
+  StrStrMap resolved_y;
+  InterpolateTbl(with_y, {}, nullptr, nullptr, resolved_y, violations);
+  IniPersistentMap prev_y(resolved_y);
+  StrStrMap without_y = {{"a.x", "${y}"}};
+  StrStrMap resolved_no_y;
+  InterpolateTbl(without_y, {}, &with_y, &prev_y, resolved_no_y, violations);
+  EXPECT_EQ(resolved_no_y["a.x"], "");
+  // and one of the same section, once the absolute key is removed, resolves
+  // to the key of the section.
+  StrStrMap absolute = {{"a.x", "${b.y}"}, {"b.y", "1"}, {"a.b.y", "2"}};
+  StrStrMap resolved_absolute;
+  InterpolateTbl(absolute, {}, nullptr, nullptr, resolved_absolute,
+                 violations);
+  EXPECT_EQ(resolved_absolute["a.x"], "1");
+  IniPersistentMap prev_absolute(resolved_absolute);
+  StrStrMap local = {{"a.x", "${b.y}"}, {"a.b.y", "2"}};
+  StrStrMap resolved_local;
+  InterpolateTbl(local, {}, &absolute, &prev_absolute, resolved_local,
+                 violations);
+  EXPECT_EQ(resolved_local["a.x"], "2");
+
+  // cycles are reported with their lines.
+  StrStrMap cyclic = {{"a.x", "${a.y}"}, {"a.y", "${x}"}, {"a.z", "${a.x}"}};
+  IniKeyLines lines = {{"a.x", 2}, {"a.y", 3}, {"a.z", 4}};
+  InterpolateTbl(cyclic, lines, nullptr, nullptr, resolved, violations);
+  ASSERT_EQ(violations.size(), 2);
+  EXPECT_EQ(violations[0].constraint,
+            "interpolation cycle: a.x (line 2) -> a.y (line 3) -> a.x (line "
+            "2)");
+}
+
+TEST(IniSettings, InheritSections_test) {
+  StrStrMap tbl = {{"base.a", "1"},  {"base.b", "2"},  {"mid.b", "3"},
+                   {"leaf.c", "4"},  {"other.a", "5"}};
+  IniSectionParents parents = {{"leaf", "mid"}, {"mid", "base"}};
+  std::vector<IniViolation> violations;
+  EXPECT_TRUE(InheritSections(tbl, parents, violations));
+  EXPECT_EQ(tbl["mid.a"], "1");
+  EXPECT_EQ(tbl["mid.b"], "3");
+  EXPECT_EQ(tbl["leaf.a"], "1");
+  EXPECT_EQ(tbl["leaf.b"], "3");
+  EXPECT_EQ(tbl["leaf.c"], "4");
+  EXPECT_EQ(tbl.count("other.b"), 0);
+  // inherited values share the storage of the parent.
+  EXPECT_TRUE(tbl["leaf.a"].SharesWith(tbl["base.a"]));
+  EXPECT_EQ(tbl["base.a"].use_count(), 3);
+
+  parents = {{"x", "y"}, {"y", "z"}, {"z", "x"}};
+  EXPECT_FALSE(InheritSections(tbl, parents, violations));
+  ASSERT_EQ(violations.size(), 3);
+  EXPECT_EQ(violations[0].constraint, "inheritance cycle: x -> y -> z -> x");
+}
+
+TEST(IniSettings, FoldIniKeys_test) {
+  EXPECT_EQ(FoldAsciiCase("Server.Max_Connections"), "server.max_connections");
+  // the word-at-a-time path and the tail, bytes around the letters and UTF-8.
+  EXPECT_EQ(FoldAsciiCase("\xc3\x89\x7f@AZ[`az{T"), "\xc3\x89\x7f@az[`az{t");
+  EXPECT_EQ(FoldAsciiCase(""), "");
+
+  StrStrMap tbl = {{"Net.MTU", "1500"}, {"net.mtu", "9000"}, {"a.b", "1"},
+                   {"Edge.Name", "e"}};
+  IniSectionParents parents = {{"Edge", "Net"}};
+  FoldIniKeys(tbl, parents);
+  ASSERT_EQ(tbl.size(), 3);
+  EXPECT_EQ(tbl["net.mtu"], "9000");
+  EXPECT_EQ(tbl["edge.name"], "e");
+  EXPECT_EQ(parents.at("edge"), "net");
+}
+
+TEST(IniSettings, IniEmbeddedTable_test) {
+  static constexpr IniEmbeddedEntry kEntries[] = {
+      {"a.x", "1"}, {"a.y", "2"}, {"b.x", "3"}};
+  constexpr IniEmbeddedTable table = {kEntries, 3};
+  ASSERT_NE(table.Find("a.y"), nullptr);
+  EXPECT_EQ(table.Find("a.y")->value, "2");
+  EXPECT_EQ(table.Find("b.x")->value, "3");
+  EXPECT_EQ(table.Find("a"), nullptr);
+  EXPECT_EQ(table.Find("c.x"), nullptr);
+  EXPECT_EQ(IniEmbeddedTable().Find("a.x"), nullptr);
+  EXPECT_EQ(std::distance(table.begin(), table.end()), 3);
+}
+
+TEST(IniSettings, IniPersistentMap_test) {
+  StrStrMap tbl = {{"a.x", "1"}, {"a.y", "2"}, {"b.x", "3"}};
+  IniPersistentMap map(tbl);
+  ASSERT_EQ(map.size(), 3);
+  ASSERT_NE(map.Find("a.y"), nullptr);
+  EXPECT_EQ(*map.Find("a.y"), "2");
+  EXPECT_EQ(map.Find("a"), nullptr);
+
+  // the versions are independent.
+  auto next = map.Set(SharedStr("a.y"), SharedStr("20")).Erase("b.x");
+  EXPECT_EQ(*map.Find("a.y"), "2");
+  EXPECT_EQ(*map.Find("b.x"), "3");
+  EXPECT_EQ(*next.Find("a.y"), "20");
+  EXPECT_EQ(next.Find("b.x"), nullptr);
+  EXPECT_EQ(next.size(), 2);
+  EXPECT_EQ(map.Erase("c.x").size(), 3);
+
+  // stays sorted and balanced through inserts and erases in any order.
+  StrStrMap expected;
+  IniPersistentMap current;
+  std::uint32_t seed = 7;
+  for (int i = 0; i < 2000; ++i) {
+    seed = seed * 1103515245 + 12345;
+    auto key = "k." + std::to_string(seed % 500);
+    if (seed % 3 == 0) {
+      expected.erase(key);
+      current = current.Erase(key);
+    } else {
+      expected.insert_or_assign(SharedStr(key), SharedStr(std::to_string(i)));
+      current = current.Set(SharedStr(key), SharedStr(std::to_string(i)));
+    }
+  }
+  ASSERT_EQ(current.size(), expected.size());
+  EXPECT_TRUE(std::equal(current.begin(), current.end(), expected.begin()));
+
+  // a reload of the same table keeps the version, a changed one its nodes.
+  EXPECT_TRUE(current.Update(expected).SharesWith(current));
+  expected.insert_or_assign(SharedStr("k.new"), SharedStr("1"));
+  expected.erase(expected.begin());
+  auto updated = current.Update(expected);
+  EXPECT_FALSE(updated.SharesWith(current));
+  ASSERT_EQ(updated.size(), expected.size());
+  EXPECT_TRUE(std::equal(updated.begin(), updated.end(), expected.begin()));
+  EXPECT_TRUE(IniPersistentMap().Update({}).empty());
+}
+
+TEST(IniSettings, Diff_test) {
+  StrStrMap tbl = {{"a.x", "1"}, {"a.y", "2"}, {"b.x", "3"}};
+  IniPersistentMap from(tbl);
+  auto to = from.Set(SharedStr("a.y"), SharedStr("20"))
+                .Erase("b.x")
+                .Set(SharedStr("a.z"), SharedStr("4"));
+  auto changes = Diff(from, to);
+  ASSERT_EQ(changes.size(), 3);
+  EXPECT_EQ(changes[0].kind, IniChangeKind::kChanged);
+  EXPECT_EQ(changes[0].key, "a.y");
+  EXPECT_EQ(changes[0].old_value, "2");
+  EXPECT_EQ(changes[0].new_value, "20");
+  EXPECT_EQ(changes[1].kind, IniChangeKind::kAdded);
+  EXPECT_EQ(changes[1].key, "a.z");
+  EXPECT_EQ(changes[2].kind, IniChangeKind::kRemoved);
+  EXPECT_EQ(changes[2].old_value, "3");
+  EXPECT_TRUE(Diff(from, IniPersistentMap(tbl)).empty());
+  EXPECT_EQ(Diff(IniPersistentMap(), from).size(), 3);
+
+  // the same changes as a merge of the whole tables, whatever the shapes.
+  for (std::size_t size : {0, 1, 300}) {
+    StrStrMap before;
+    for (std::size_t i = 0; i < size; ++i) {
+      before.emplace(SharedStr("k." + std::to_string(i * 2)), SharedStr("v"));
+    }
+    StrStrMap after = before;
+    IniPersistentMap base(before);
+    IniPersistentMap current = base;
+    std::uint32_t seed = 11;
+    for (int i = 0; i < 100; ++i) {
+      seed = seed * 1103515245 + 12345;
+      auto key = "k." + std::to_string(seed % 700);
+      if (seed % 4 == 0) {
+        after.erase(key);
+        current = current.Erase(key);
+      } else {
+        after.insert_or_assign(SharedStr(key), SharedStr(std::to_string(i)));
+        current = current.Set(SharedStr(key), SharedStr(std::to_string(i)));
+      }
+    }
+    std::vector<std::string> expected;
+    for (const auto& [key, value] : before) {
+      auto it = after.find(key);
+      if (it == after.end()) {
+        expected.push_back("-" + key.str());
+      } else if (it->second != value) {
+        expected.push_back("~" + key.str());
+      }
+    }
+    for (const auto& [key, value] : after) {
+      if (before.find(key) == before.end()) {
+        expected.push_back("+" + key.str());
+      }
+    }
+    std::sort(expected.begin(), expected.end(),
+              [](const std::string& a, const std::string& b) {
+                return a.substr(1) < b.substr(1);
+              });
+    // with the shared nodes, and without.
+    for (const auto& old_map : {base, IniPersistentMap(before)}) {
+      std::vector<std::string> found;
+      for (const auto& change : Diff(old_map, current)) {
+        const char* mark = change.kind == IniChangeKind::kAdded     ? "+"
+                           : change.kind == IniChangeKind::kRemoved ? "-"
+                                                                    : "~";
+        found.push_back(mark + change.key.str());
+      }
+      EXPECT_EQ(found, expected);
+    }
+  }
+}
+
+TEST(IniSettings, SharedStr_test) {
+  SharedStr str("value");
+  SharedStr copy = str;
+  EXPECT_TRUE(copy.SharesWith(str));
+  EXPECT_EQ(str.use_count(), 2);
+  EXPECT_EQ(copy, "value");
+  EXPECT_EQ(copy.str(), std::string("value"));
+  EXPECT_TRUE(SharedStr().empty());
+  EXPECT_FALSE(SharedStr("value").SharesWith(str));
+}
+
+TEST(IniSettings, IniStringPool_test) {
+  auto& pool = IniStringPool::Instance();
+  pool.Prune();
+  auto before = pool.Stats();
+  std::string content =
+      "[a]\nenabled = true\nhost = db-01\n[b]\nenabled = true\n";
+  StrStrMap first;
+  StrStrMap second;
+  std::istringstream first_stream(content);
+  std::istringstream second_stream(content);
+  ReadIni(first_stream, first, {nullptr, nullptr, nullptr, &pool});
+  ReadIni(second_stream, second, {nullptr, nullptr, nullptr, &pool});
+  EXPECT_TRUE(first["a.enabled"].SharesWith(first["b.enabled"]));
+  EXPECT_TRUE(first["a.host"].SharesWith(second["a.host"]));
+  EXPECT_TRUE(first.find("a.host")->first.SharesWith(
+      second.find("a.host")->first));
+
+  // a.enabled, a.host, b.enabled and the values true and db-01.
+  auto stats = pool.Stats();
+  EXPECT_EQ(stats.strings, before.strings + 5);
+  EXPECT_EQ(stats.lookups, before.lookups + 12);
+  EXPECT_EQ(stats.hits, before.hits + 7);
+
+  // the strings are released once the tables are gone.
+  EXPECT_EQ(pool.Prune(), 0);
+  first.clear();
+  second.clear();
+  EXPECT_EQ(pool.Prune(), 5);
+  EXPECT_EQ(pool.Stats().bytes, before.bytes);
+
+  // `Collect` leaves a few released strings, and prunes once they pile up.
+  pool.Intern("released");
+  EXPECT_EQ(pool.Collect(), 0);
+  EXPECT_EQ(pool.Prune(), 1);
+  std::vector<SharedStr> strings;
+  for (int i = 0; i < 4096; ++i) {
+    strings.push_back(pool.Intern("string" + std::to_string(i)));
+  }
+  strings.clear();
+  EXPECT_EQ(pool.Collect(), 4096);
+  EXPECT_EQ(pool.Stats().strings, before.strings);
+}
+
+TEST(IniSettings, IndexIniSections_test) {
+  std::string content = "; comment\n[a]\nx = 1\n  [ b.c ]\ny = 2\n[a]\nz = 3";
+  IniSectionIndex index;
+  EXPECT_TRUE(IndexIniSections(content, index));
+  ASSERT_EQ(index.size(), 2);
+  ASSERT_EQ(index["a"].size(), 2);
+  EXPECT_EQ(content.substr(index["a"][0].begin,
+                           index["a"][0].end - index["a"][0].begin),
+            "[a]\nx = 1\n");
+  EXPECT_EQ(content.substr(index["a"][1].begin), "[a]\nz = 3");
+  EXPECT_EQ(index["b.c"][0].begin, content.find("  [ b.c ]"));
+
+  IniSectionIndex ignored;
+  EXPECT_FALSE(IndexIniSections("@include base.ini\n[a]\n", ignored));
+  EXPECT_FALSE(IndexIniSections("[a : b]\n", ignored));
+
+  // a continued value goes on over lines starting with `[`.
+  std::string continued = "[a]\nx = 1, \\\n[2] \\\n  [3]\n[b]\ny = 4\n";
+  IniSectionIndex sections;
+  EXPECT_TRUE(IndexIniSections(continued, sections));
+  ASSERT_EQ(sections.size(), 2);
+  EXPECT_EQ(sections["a"][0].end, continued.find("[b]"));
+}
+
+TEST(IniSettings, ReadIni_diagnostics_test) {
+  std::string content =
+      "[a]\nx = 1\n  [b\nnovalue\n= 2\nx = 3\n[a]\n";
+  StrStrMap tbl;
+  IniDiagnostics diagnostics;
+  std::size_t sunk = 0;
+  diagnostics.sink = [&](const IniDiagnostic&) { ++sunk; };
+  std::istringstream stream(content);
+  ReadIni(stream, tbl, {nullptr, nullptr, nullptr, nullptr, &diagnostics});
+  ASSERT_EQ(diagnostics.entries.size(), 5);
+  EXPECT_EQ(sunk, 5);
+  const auto& unmatched = diagnostics.entries[0];
+  EXPECT_EQ(unmatched.kind, IniDiagnosticKind::kUnmatchedBracket);
+  EXPECT_EQ(unmatched.line, 3);
+  EXPECT_EQ(unmatched.column, 3);
+  EXPECT_EQ(unmatched.offset, content.find("[b"));
+  EXPECT_EQ(diagnostics.entries[1].kind, IniDiagnosticKind::kMissingEquals);
+  EXPECT_EQ(diagnostics.entries[2].kind, IniDiagnosticKind::kEmptyKey);
+  EXPECT_EQ(diagnostics.entries[3].kind, IniDiagnosticKind::kDuplicateKey);
+  EXPECT_EQ(diagnostics.entries[3].offset, content.find("x = 3"));
+  EXPECT_EQ(diagnostics.entries[4].kind, IniDiagnosticKind::kDuplicateSection);
+  EXPECT_EQ(diagnostics.entries[4].line, 7);
+  EXPECT_STREQ(IniDiagnosticMessage(diagnostics.entries[4].kind),
+               "duplicated section name");
+
+  // past the limit, the diagnostics are only counted.
+  IniDiagnostics capped;
+  capped.limit = 2;
+  StrStrMap capped_tbl;
+  std::istringstream capped_stream(content);
+  ReadIni(capped_stream, capped_tbl,
+          {nullptr, nullptr, nullptr, nullptr, &capped});
+  EXPECT_EQ(capped.entries.size(), 2);
+  EXPECT_EQ(capped.dropped, 3);
+}
+
+TEST(IniSettings, ReadIni_utf8_test) {
+  EXPECT_EQ(FindInvalidUtf8("plain ascii, longer than a word"),
+            std::string_view::npos);
+  EXPECT_EQ(FindInvalidUtf8("caf\xc3\xa9 \xe6\x97\xa5 \xf0\x9f\x98\x80"),
+            std::string_view::npos);
+  EXPECT_EQ(FindInvalidUtf8("abc\xff"), 3);
+  EXPECT_EQ(FindInvalidUtf8("\xc0\xaf"), 0);          // overlong '/'
+  EXPECT_EQ(FindInvalidUtf8("ok \xed\xa0\x80"), 3);   // surrogate
+  EXPECT_EQ(FindInvalidUtf8("ok \xf4\x90\x80\x80"), 3);  // past U+10FFFF
+  EXPECT_EQ(FindInvalidUtf8("12345678\xe6\x97"), 8);  // truncated
+
+  // the byte order mark is not part of the first section name.
+  std::string content =
+      "\xEF\xBB\xBF[a]\nx = caf\xc3\xa9\ny = \xc3(\nz = \xff\n";
+  StrStrMap tbl;
+  IniDiagnostics diagnostics;
+  std::istringstream stream(content);
+  ReadIni(stream, tbl,
+          {nullptr, nullptr, nullptr, nullptr, &diagnostics, nullptr, true});
+  EXPECT_EQ(tbl["a.x"], "caf\xc3\xa9");
+  ASSERT_EQ(diagnostics.entries.size(), 1);
+  EXPECT_EQ(diagnostics.entries[0].kind, IniDiagnosticKind::kInvalidUtf8);
+  EXPECT_EQ(diagnostics.entries[0].line, 3);
+  EXPECT_EQ(diagnostics.entries[0].column, 5);
+  EXPECT_EQ(diagnostics.entries[0].offset, content.find("\xc3("));
+
+  IniSectionIndex index;
+  EXPECT_TRUE(IndexIniSections(content, index));
+  ASSERT_EQ(index.count("a"), 1);
+  EXPECT_EQ(index["a"][0].begin, kUtf8Bom.size());
+  IniDocument document(content);
+  document.SetValue("a.x", "1");
+  EXPECT_EQ(document.str().substr(0, 13), "\xEF\xBB\xBF[a]\nx = 1\n");
+}
+
+TEST(IniSettings, ReadIni_limits_test) {
+  auto read = [](const std::string& content, const IniLimits& limits,
+                 StrStrMap& tbl, IniDiagnostics& diagnostics) {
+    std::istringstream stream(content);
+    return ReadIni(stream, tbl,
+                   {nullptr, nullptr, nullptr, nullptr, &diagnostics, nullptr,
+                    false, &limits});
+  };
+  std::string content = "[a]\nx = 1\ny = 22\nz = 333\n";
+  IniLimits limits;
+  StrStrMap tbl;
+  IniDiagnostics diagnostics;
+  EXPECT_TRUE(read(content, limits, tbl, diagnostics));
+  EXPECT_EQ(tbl.size(), 3);
+
+  // each bound stops the parse at the first line past it.
+  struct Case {
+    IniLimits limits;
+    IniDiagnosticKind kind;
+    std::uint32_t line;
+    std::size_t keys;
+  };
+  for (const auto& c : {Case{{6, 0, 0, 0}, IniDiagnosticKind::kLineTooLong,
+                             4, 2},
+                        Case{{0, 2, 0, 0}, IniDiagnosticKind::kTooManyKeys,
+                             4, 2},
+                        Case{{0, 0, 2, 0}, IniDiagnosticKind::kValueTooLarge,
+                             4, 2},
+                        Case{{0, 0, 0, 15}, IniDiagnosticKind::kFileTooLarge,
+                             3, 1}}) {
+    StrStrMap bounded;
+    IniDiagnostics reported;
+    EXPECT_FALSE(read(content, c.limits, bounded, reported));
+    EXPECT_EQ(bounded.size(), c.keys);
+    ASSERT_EQ(reported.entries.size(), 1);
+    EXPECT_EQ(reported.entries[0].kind, c.kind);
+    EXPECT_EQ(reported.entries[0].line, c.line);
+  }
+
+  // continuation lines add up, and a long line is not read past its bound.
+  StrStrMap continued;
+  IniDiagnostics reported;
+  EXPECT_FALSE(read("[a]\nx = 1234 \\\n 5678 \\\n 9\n", {0, 0, 8, 0},
+                    continued, reported));
+  ASSERT_EQ(reported.entries.size(), 1);
+  EXPECT_EQ(reported.entries[0].kind, IniDiagnosticKind::kValueTooLarge);
+  std::istringstream stream("[a]\n" + std::string(1 << 20, 'x') + "\n");
+  IniLimits line_limit{64, 0, 0, 0};
+  EXPECT_FALSE(ReadIni(stream, continued,
+                       {nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+                        false, &line_limit}));
+  EXPECT_EQ(stream.tellg(), 4 + 65);
+}
+
+TEST(IniSettings, IniDocument_test) {
+  std::string content =
+      "; operator notes\n"
+      "[net]\n"
+      "mtu = 1500  ; jumbo later\n"
+      "\n"
+      "# the database\n"
+      "[db.primary]\n"
+      "host=db-01\n"
+      "[net]\n"
+      "vlan = 7";
+  IniDocument document(content);
+  EXPECT_EQ(document.LineCount(), 9);
+  EXPECT_EQ(document.str(), content);
+
+  document.SetValue("net.mtu", "9000");
+  document.SetValue("net.vlan", "8");
+  document.SetValue("net.bond", "on");
+  document.SetValue("db.primary.port", "5432");
+  document.SetValue("log.level", "info");
+  EXPECT_EQ(document.str(),
+            "; operator notes\n"
+            "[net]\n"
+            "mtu = 9000  ; jumbo later\n"
+            "\n"
+            "# the database\n"
+            "[db.primary]\n"
+            "host=db-01\n"
+            "port=5432\n"
+            "[net]\n"
+            "vlan = 8\n"
+            "bond = on\n"
+            "\n"
+            "[log]\n"
+            "level=info\n");
+}
+
+TEST(IniSettings, ScanIniValue_test) {
+  std::string buffer;
+  std::string text = "  plain value  ; comment";
+  auto token = ScanIniValue(text, buffer);
+  EXPECT_EQ(token.value, "plain value");
+  // not copied.
+  EXPECT_EQ(token.value.data(), text.data() + 2);
+  EXPECT_EQ(text.substr(token.begin, token.end - token.begin), "plain value");
+
+  EXPECT_EQ(ScanIniValue(R"( a\;b\#c # d)", buffer).value, "a;b#c");
+  EXPECT_EQ(ScanIniValue(R"( C:\temp\new)", buffer).value, R"(C:\temp\new)");
+  token = ScanIniValue(R"( "https://host/#top" ; comment)", buffer);
+  EXPECT_EQ(token.value, "https://host/#top");
+  EXPECT_EQ(token.end, 20);
+  EXPECT_EQ(ScanIniValue(R"("say \"hi\"\n\\")", buffer).value,
+            "say \"hi\"\n\\");
+  EXPECT_TRUE(ScanIniValue(R"("open)", buffer).unterminated);
+
+  token = ScanIniValue(" first \\  ", buffer);
+  EXPECT_TRUE(token.continued);
+  EXPECT_EQ(token.value, "first ");
+  // only the last `\` continues, however many spaces follow it.
+  token = ScanIniValue(" a\\b\\ c \\   \t", buffer);
+  EXPECT_TRUE(token.continued);
+  EXPECT_EQ(token.value, "a\\b\\ c ");
+
+  for (std::string value : {"plain", " spaced ", "a#b", "\"quoted\"",
+                            "line\nbreak", "back\\slash\\", ""}) {
+    auto written = FormatIniValue(value);
+    EXPECT_EQ(ScanIniValue(written, buffer).value, value) << written;
+  }
+  EXPECT_EQ(FormatIniValue("plain"), "plain");
+  EXPECT_EQ(FormatIniValue("a#b"), "\"a#b\"");
+}
+
+TEST(IniSettings, ReadIni_continuation_test) {
+  std::istringstream stream(
+      "[a]\n"
+      "list = one, \\\n"
+      "       two, \\\n"
+      "       three ; comment\n"
+      "next = \"x;y\"\n");
+  StrStrMap tbl;
+  ReadIni(stream, tbl);
+  EXPECT_EQ(tbl["a.list"], "one, two, three");
+  EXPECT_EQ(tbl["a.next"], "x;y");
+
+  IniDocument document(
+      "[a]\n"
+      "list = one, \\\n"
+      "       two\n"
+      "next = 1\n");
+  document.SetValue("a.list", "#1");
+  EXPECT_EQ(document.str(),
+            "[a]\n"
+            "list = \"#1\"\n"
+            "next = 1\n");
+
+  // a new key goes after the continuation lines of the last key.
+  IniDocument continued("[s]\nk = a \\\n  b\n");
+  continued.SetValue("s.new", "1");
+  EXPECT_EQ(continued.str(), "[s]\nk = a \\\n  b\nnew = 1\n");
+  std::istringstream written(continued.str());
+  tbl.clear();
+  ReadIni(written, tbl);
+  EXPECT_EQ(tbl["s.k"], "a b");
+  EXPECT_EQ(tbl["s.new"], "1");
+}
+
+TEST(IniSettings, ReadIni_many_backslashes_test) {
+  // a megabyte continuation line of backslashes then spaces, within the
+  // default line bound: a quadratic scan takes minutes on it.
+  std::string content = "[a]\nk = a \\\n";
+  for (int i = 0; i < (1 << 18); ++i) {
+    content += "\\x";
+  }
+  content += std::string(1 << 19, ' ') + "\nnext = 1\n";
+  std::istringstream stream(content);
+  StrStrMap tbl;
+  auto start = std::chrono::steady_clock::now();
+  ReadIni(stream, tbl);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+  EXPECT_EQ(tbl["a.k"].size(), 2 + (1 << 19));
+  EXPECT_EQ(tbl["a.next"], "1");
+}
+
 TEST(IniSettings, Trim_test) {
   std::string str = "  test  ";
   EXPECT_EQ(Trim(str), "test");
@@ -55,6 +799,14 @@ TEST(IniSettings, Trim_test) {
   str = "  im  a  test  ";
   EXPECT_EQ(Trim(str), "im  a  test");
 
+  // ASCII whitespaces, without a copy.
+  str = "\t key \r\n";
+  auto view = Trim(str);
+  EXPECT_EQ(view, "key");
+  EXPECT_EQ(view.data(), str.data() + 2);
+  EXPECT_TRUE(IsAsciiSpace('\v'));
+  EXPECT_FALSE(IsAsciiSpace('\xa0'));
+
   // trim with locale
   str = "  test  ";
   EXPECT_EQ(Trim(str, std::locale("")), "test");
@@ -110,6 +862,26 @@ TEST(IniSettings, Split_test) {
   EXPECT_EQ(vec[0], "test ");
 }
 
+TEST(IniSettings, SplitView_test) {
+  std::string str = ",a, b,,c,";
+  std::vector<std::string_view> tokens;
+  for (auto token : SplitView(str, ", ")) {
+    tokens.push_back(token);
+  }
+  ASSERT_EQ(tokens.size(), 3);
+  EXPECT_EQ(tokens[0], "a");
+  EXPECT_EQ(tokens[1], "b");
+  EXPECT_EQ(tokens[2], "c");
+  // the tokens view the string.
+  EXPECT_EQ(tokens[2].data(), str.data() + 7);
+
+  SplitView key("section.sub.key", ".");
+  EXPECT_EQ(std::distance(key.begin(), key.end()), 3);
+  EXPECT_EQ(*key.begin(), "section");
+  EXPECT_EQ(SplitView("", ",").begin(), SplitView("", ",").end());
+  EXPECT_EQ(SplitView(",,,", ",").begin(), SplitView(",,,", ",").end());
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
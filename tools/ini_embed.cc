@@ -0,0 +1,101 @@
+// Generates the source of an `IniEmbeddedTable` from an ini file, see the
+// `ini_embed` CMake function.
+//
+//   ini_embed <input.ini> <output.cc> <output.h> <symbol>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "settings.h"
+
+namespace {
+
+// a C++ string literal of `text`: octal escapes can't swallow the next
+// character like hexadecimal ones do.
+std::string Literal(std::string_view text) {
+  std::string literal = "\"";
+  for (char ch : text) {
+    auto byte = static_cast<unsigned char>(ch);
+    if (ch == '"' || ch == '\\') {
+      literal += '\\';
+      literal += ch;
+    } else if (byte < 0x20 || byte >= 0x7f || ch == '?') {
+      char escape[5];
+      std::snprintf(escape, sizeof(escape), "\\%03o", byte);
+      literal += escape;
+    } else {
+      literal += ch;
+    }
+  }
+  return literal + "\"";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc != 5) {
+    std::cerr << "usage: " << argv[0]
+              << " <input.ini> <output.cc> <output.h> <symbol>\n";
+    return 2;
+  }
+  const std::string input = argv[1];
+  const std::string symbol = argv[4];
+  std::ifstream stream(input);
+  if (!stream) {
+    std::cerr << input << ": can't be opened\n";
+    return 1;
+  }
+  StrStrMap tbl;
+  std::vector<IniInclude> includes;
+  IniSectionParents parents;
+  IniDiagnostics diagnostics;
+  ReadIni(stream, tbl, {nullptr, &includes, &parents, nullptr, &diagnostics});
+  for (const auto& diagnostic : diagnostics.entries) {
+    std::cerr << input << ":" << diagnostic.line << ":" << diagnostic.column
+              << ": warning: " << IniDiagnosticMessage(diagnostic.kind)
+              << "\n";
+  }
+  if (!includes.empty()) {
+    std::cerr << input << ":" << includes[0].line
+              << ": error: @include can't be embedded\n";
+    return 1;
+  }
+  // the table is served as is, inheriting sections are flattened here.
+  std::vector<IniViolation> violations;
+  if (!InheritSections(tbl, parents, violations)) {
+    std::cerr << input << ": error: " << violations[0].constraint << "\n";
+    return 1;
+  }
+
+  std::ofstream header(argv[3]);
+  header << "// Generated by ini_embed from " << input << ", do not edit.\n"
+         << "#pragma once\n\n"
+         << "#include \"settings.h\"\n\n"
+         << "extern const IniEmbeddedTable " << symbol << ";\n";
+  std::ofstream source(argv[2]);
+  source << "// Generated by ini_embed from " << input << ", do not edit.\n"
+         << "#include \"" << symbol << ".h\"\n\n"
+         << "namespace {\n\n"
+         << "constexpr IniEmbeddedEntry kEntries[] = {\n";
+  for (const auto& [key, value] : tbl) {
+    source << "    {" << Literal(key) << ", " << Literal(value) << "},\n";
+  }
+  if (tbl.empty()) {
+    source << "    {\"\", \"\"},\n";
+  }
+  source << "};\n\n"
+         << "}  // namespace\n\n"
+         << "constexpr IniEmbeddedTable " << symbol << " = {kEntries, "
+         << tbl.size() << "};\n";
+  header.close();
+  source.close();
+  if (!header || !source) {
+    std::cerr << argv[0] << ": the output can't be written\n";
+    return 1;
+  }
+  return 0;
+}